@@ -0,0 +1,657 @@
+#pragma once
+
+#include "structures.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <queue>
+#include <set>
+
+/* -------------------------------------------------------------------------
+   Set of blocked positions on the board
+   ------------------------------------------------------------------------- */
+/* Declarations */
+class Board;
+struct ExplosionCross;
+class ExplosionSet;
+class BombTracker;
+template <class V>
+class PlayerTable;
+
+/* Definitions */
+/* Cells reached by the explosion of a single bomb: the vertical run from
+   (center.x, down) to (center.x, up) and the horizontal run from
+   (left, center.y) to (right, center.y), all bounds inclusive */
+struct ExplosionCross {
+    Position center;
+    uint16_t left;
+    uint16_t right;
+    uint16_t down;
+    uint16_t up;
+
+    bool contains(Position position) const {
+        return (position.y == center.y && left <= position.x && position.x <= right)
+            || (position.x == center.x && down <= position.y && position.y <= up);
+    }
+};
+
+/* Blocks are bits of a bitset indexed by x * size_y + y, which gives O(1)
+   lookups and iteration in Position order. Boards up to DENSE_CELLS_LIMIT
+   cells keep the whole bitset as one tile allocated up front. Larger boards
+   are split into tiles of TILE_CELLS cells allocated on their first block,
+   so memory follows the blocks placed instead of the board area.
+   Every row and column also keeps an ordered index of its blocks, so the
+   block nearest to a position along a line is found in O(log blocks). */
+class Board {
+public:
+    static constexpr size_t DENSE_CELLS_LIMIT = 1 << 24;
+    static constexpr size_t TILE_CELLS = 1 << 16;
+
+    Board() = default;
+
+    /* empties the board and sizes it for size_x * size_y cells */
+    void reset(uint16_t size_x, uint16_t size_y) {
+        this->size_x = size_x;
+        this->size_y = size_y;
+        size_t cells = (size_t) size_x * size_y;
+        bool dense = cells <= DENSE_CELLS_LIMIT;
+        tile_words = dense ? (cells + 63) / 64 : TILE_CELLS / 64;
+        size_t tile_cells = 64 * tile_words;
+        size_t tiles_count = tile_cells == 0 ? 0 : (cells + tile_cells - 1) / tile_cells;
+        tiles.assign(tiles_count, std::vector<uint64_t>(dense ? tile_words : 0));
+        rows.assign(size_y, { });
+        columns.assign(size_x, { });
+        count = 0;
+    }
+
+    bool on_board(Position position) const {
+        return position.x < size_x && position.y < size_y;
+    }
+
+    bool contains(Position position) const {
+        if (!on_board(position)) {
+            return false;
+        }
+        auto [tile, word, bit] = locate(position);
+        return !tiles[tile].empty() && (tiles[tile][word] & bit);
+    }
+
+    /* returns false if the position was already blocked or is off the board */
+    bool insert(Position position) {
+        if (!on_board(position)) {
+            return false;
+        }
+        auto [tile, word, bit] = locate(position);
+        if (tiles[tile].empty()) {
+            tiles[tile].resize(tile_words);
+        }
+        if (tiles[tile][word] & bit) {
+            return false;
+        }
+        tiles[tile][word] |= bit;
+        rows[position.y].insert(position.x);
+        columns[position.x].insert(position.y);
+        count++;
+        return true;
+    }
+
+    /* returns false if the position was not blocked */
+    bool erase(Position position) {
+        if (!on_board(position)) {
+            return false;
+        }
+        auto [tile, word, bit] = locate(position);
+        if (tiles[tile].empty() || !(tiles[tile][word] & bit)) {
+            return false;
+        }
+        tiles[tile][word] &= ~bit;
+        rows[position.y].erase(position.x);
+        columns[position.x].erase(position.y);
+        count--;
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    /* calls f for every blocked position in increasing Position order */
+    template <class F>
+    void for_each(F &&f) const {
+        for (size_t tile = 0; tile < tiles.size(); tile++) {
+            for (size_t word = 0; word < tiles[tile].size(); word++) {
+                uint64_t bits = tiles[tile][word];
+                while (bits) {
+                    size_t index = (tile * tile_words + word) * 64 + std::countr_zero(bits);
+                    f(Position {(uint16_t) (index / size_y), (uint16_t) (index % size_y)});
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    /* Explosion of a bomb at center: each arm spans radius cells and stops on
+       the board edge or on the first block, which is still reached. The cost
+       does not depend on radius. center has to be on the board. */
+    ExplosionCross explosion(Position center, uint16_t radius) const {
+        ExplosionCross cross = {
+            center,
+            (uint16_t) std::max<int32_t>(center.x - radius, 0),
+            (uint16_t) std::min<int32_t>(center.x + radius, size_x - 1),
+            (uint16_t) std::max<int32_t>(center.y - radius, 0),
+            (uint16_t) std::min<int32_t>(center.y + radius, size_y - 1),
+        };
+
+        std::set<uint16_t> const &row = rows[center.y];
+        std::set<uint16_t> const &column = columns[center.x];
+        if (auto block = row.lower_bound(center.x); block != row.end()) {
+            cross.right = std::min(cross.right, *block);
+        }
+        if (auto block = row.upper_bound(center.x); block != row.begin()) {
+            cross.left = std::max(cross.left, *std::prev(block));
+        }
+        if (auto block = column.lower_bound(center.y); block != column.end()) {
+            cross.up = std::min(cross.up, *block);
+        }
+        if (auto block = column.upper_bound(center.y); block != column.begin()) {
+            cross.down = std::max(cross.down, *std::prev(block));
+        }
+        return cross;
+    }
+
+private:
+    struct Location {
+        size_t tile;
+        size_t word;
+        uint64_t bit;
+    };
+
+    Location locate(Position position) const {
+        size_t index = (size_t) position.x * size_y + position.y;
+        size_t word = index / 64;
+        return {word / tile_words, word % tile_words, (uint64_t) 1 << (index % 64)};
+    }
+
+    uint16_t size_x = 0;
+    uint16_t size_y = 0;
+    size_t tile_words = 0;
+    size_t count = 0;
+    std::vector<std::vector<uint64_t>> tiles;
+    std::vector<std::set<uint16_t>> rows;
+    std::vector<std::set<uint16_t>> columns;
+};
+
+/* Board is sent as the List<Position> of its blocks */
+template <ByteSink Sink>
+void serialize(Board const &board, Sink &sb) {
+    size_t size = sizeof(uint32_t) + board.size() * fixed_wire_size_v<Position>;
+    std::byte *out = (std::byte *) sb.prepare(size).data();
+    out = encode_fixed((uint32_t) board.size(), out);
+    board.for_each([&out](Position position) {
+        out = encode_fixed(position, out);
+    });
+    sb.commit(size);
+}
+
+inline size_t serialized_size(Board const &board) {
+    return sizeof(uint32_t) + board.size() * fixed_wire_size_v<Position>;
+}
+
+/* -------------------------------------------------------------------------
+   Union of the explosions of one turn
+   ------------------------------------------------------------------------- */
+/* Explosions are kept as the horizontal and vertical runs of their crosses.
+   Overlapping runs on the same line are merged, and the set-theoretic union
+   of all cells is only expanded, in Position order, while being serialized. */
+class ExplosionSet {
+public:
+    void clear() {
+        vertical.clear();
+        horizontal.clear();
+        normalized = true;
+        cells = 0;
+    }
+
+    void add(ExplosionCross const &cross) {
+        vertical.push_back({cross.center.x, cross.down, cross.up});
+        horizontal.push_back({cross.center.y, cross.left, cross.right});
+        normalized = false;
+    }
+
+    /* number of distinct exploded cells */
+    size_t size() const {
+        normalize();
+        return cells;
+    }
+
+    /* calls f for every exploded cell once, in increasing Position order */
+    template <class F>
+    void for_each(F &&f) const {
+        normalize();
+        sweep(f);
+    }
+
+private:
+    /* cells (line, from..to) of a vertical run or (from..to, line) of a horizontal one */
+    struct Run {
+        uint16_t line;
+        uint16_t from;
+        uint16_t to;
+    };
+
+    /* sorts runs by line and merges the overlapping or adjacent ones */
+    static void merge_runs(std::vector<Run> &runs) {
+        std::sort(runs.begin(), runs.end(), [](Run const &a, Run const &b) {
+            return a.line != b.line ? a.line < b.line : a.from < b.from;
+        });
+        size_t merged = 0;
+        for (size_t i = 0; i < runs.size(); i++) {
+            if (merged > 0 && runs[merged - 1].line == runs[i].line &&
+                runs[i].from <= runs[merged - 1].to + 1) {
+                runs[merged - 1].to = std::max(runs[merged - 1].to, runs[i].to);
+            }
+            else {
+                runs[merged++] = runs[i];
+            }
+        }
+        runs.resize(merged);
+    }
+
+    void normalize() const {
+        if (normalized) {
+            return;
+        }
+        merge_runs(vertical);
+        merge_runs(horizontal);
+        /* horizontal runs are swept by the column they start in */
+        std::sort(horizontal.begin(), horizontal.end(), [](Run const &a, Run const &b) {
+            return a.from < b.from;
+        });
+        cells = 0;
+        sweep([this](Position) { cells++; });
+        normalized = true;
+    }
+
+    /* Sweeps the columns hit by any run from left to right. The rows of the
+       horizontal runs crossing the current column are kept ordered, then
+       merged with the vertical runs of that column. */
+    template <class F>
+    void sweep(F &&f) const {
+        using RunEnd = std::pair<uint16_t, uint16_t>; // last column, row
+        std::priority_queue<RunEnd, std::vector<RunEnd>, std::greater<RunEnd>> ends;
+        std::set<uint16_t> rows;
+        size_t next_vertical = 0;
+        size_t next_horizontal = 0;
+        uint32_t x = 0;
+
+        while (next_vertical < vertical.size() || next_horizontal < horizontal.size() ||
+               !rows.empty()) {
+            if (rows.empty()) {
+                x = UINT32_MAX;
+                if (next_vertical < vertical.size()) {
+                    x = vertical[next_vertical].line;
+                }
+                if (next_horizontal < horizontal.size()) {
+                    x = std::min<uint32_t>(x, horizontal[next_horizontal].from);
+                }
+            }
+            for (; next_horizontal < horizontal.size() && horizontal[next_horizontal].from == x;
+                 next_horizontal++) {
+                rows.insert(horizontal[next_horizontal].line);
+                ends.push({horizontal[next_horizontal].to, horizontal[next_horizontal].line});
+            }
+
+            auto row = rows.begin();
+            for (; next_vertical < vertical.size() && vertical[next_vertical].line == x;
+                 next_vertical++) {
+                Run const &run = vertical[next_vertical];
+                for (; row != rows.end() && *row < run.from; row++) {
+                    f(Position {(uint16_t) x, *row});
+                }
+                for (uint32_t y = run.from; y <= run.to; y++) {
+                    f(Position {(uint16_t) x, (uint16_t) y});
+                }
+                for (; row != rows.end() && *row <= run.to; row++) { }
+            }
+            for (; row != rows.end(); row++) {
+                f(Position {(uint16_t) x, *row});
+            }
+
+            for (; !ends.empty() && ends.top().first == x; ends.pop()) {
+                rows.erase(ends.top().second);
+            }
+            x++;
+        }
+    }
+
+    mutable std::vector<Run> vertical;
+    mutable std::vector<Run> horizontal;
+    mutable bool normalized = true;
+    mutable size_t cells = 0;
+};
+
+/* ExplosionSet is sent as the List<Position> of its cells */
+template <ByteSink Sink>
+void serialize(ExplosionSet const &explosions, Sink &sb) {
+    size_t size = sizeof(uint32_t) + explosions.size() * fixed_wire_size_v<Position>;
+    std::byte *out = (std::byte *) sb.prepare(size).data();
+    out = encode_fixed((uint32_t) explosions.size(), out);
+    explosions.for_each([&out](Position position) {
+        out = encode_fixed(position, out);
+    });
+    sb.commit(size);
+}
+
+inline size_t serialized_size(ExplosionSet const &explosions) {
+    return sizeof(uint32_t) + explosions.size() * fixed_wire_size_v<Position>;
+}
+
+/* -------------------------------------------------------------------------
+   Bombs on the board and their timers
+   ------------------------------------------------------------------------- */
+/* Bombs are kept in slots indexed by BombId counted from the oldest bomb
+   still alive, as the server hands ids out in increasing order. The slots
+   form a ring buffer which only grows, so a steady stream of bombs placed
+   and exploded does not allocate. Timers are never decremented: every bomb
+   stores the tick it is due at and its timer is derived from the current
+   tick when it is read. A timing wheel of bomb_timer + 1 buckets lists the
+   bombs by due tick, so the bombs due at the current tick are at hand
+   without scanning all of them. Per tick the work is proportional to the
+   bombs placed and exploded in it.
+
+   The ring only spans twice the alive bombs. A bomb whose id lies further
+   from the others, such as one outliving many newer bombs, is moved to a
+   small ordered map instead of stretching the ring over the whole gap. */
+class BombTracker {
+public:
+    void reset(uint16_t bomb_timer) {
+        this->bomb_timer = bomb_timer;
+        head = 0;
+        used = 0;
+        wheel.resize((size_t) bomb_timer + 1);
+        for (std::vector<BombId> &bucket : wheel) {
+            bucket.clear();
+        }
+        first_id = 0;
+        alive = 0;
+        tick = 0;
+        stragglers.clear();
+    }
+
+    /* moves to the next turn, which decrements every timer by one */
+    void advance() {
+        /* the bucket of the past tick is reused for bombs placed in this one */
+        wheel[tick % wheel.size()].clear();
+        tick++;
+    }
+
+    void place(BombId id, Position position) {
+        Slot placed = {position, tick + bomb_timer, true};
+        wheel[placed.due_tick % wheel.size()].push_back(id);
+        if (used == 0) {
+            first_id = id;
+        }
+        if (id < first_id) {
+            if ((size_t) (first_id - id) + used > window_limit()) {
+                alive += stragglers.insert_or_assign(id, placed).second;
+                return;
+            }
+            while (id < first_id) {
+                reserve(used + 1);
+                head = (head - 1) & (ring.size() - 1);
+                used++;
+                slot(0) = { };
+                first_id--;
+            }
+        }
+        if (id - first_id >= used) {
+            /* the oldest bombs give way to the new one when the ring would
+               grow too wide, so the ring stays proportional to alive bombs */
+            while (used > 0 && (size_t) (id - first_id) + 1 > window_limit()) {
+                if (slot(0).alive) {
+                    stragglers.emplace(first_id, slot(0));
+                }
+                pop_front();
+            }
+            while (used > 0 && !slot(0).alive) {
+                pop_front();
+            }
+            if (used == 0) {
+                first_id = id;
+            }
+            size_t needed = (size_t) (id - first_id) + 1;
+            reserve(needed);
+            for (; used < needed; used++) {
+                slot(used) = { };
+            }
+        }
+        Slot &target = slot(id - first_id);
+        alive += !target.alive;
+        target = placed;
+    }
+
+    /* returns the bomb with its current timer, if it is alive */
+    std::optional<Bomb> find(BombId id) const {
+        if (in_ring(id)) {
+            return to_bomb(slot(id - first_id));
+        }
+        if (auto straggler = stragglers.find(id); straggler != stragglers.end()) {
+            return to_bomb(straggler->second);
+        }
+        return std::nullopt;
+    }
+
+    void explode(BombId id) {
+        if (!in_ring(id)) {
+            alive -= stragglers.erase(id);
+            return;
+        }
+        slot(id - first_id).alive = false;
+        alive--;
+        while (used > 0 && !slot(0).alive) {
+            pop_front();
+        }
+    }
+
+    size_t size() const {
+        return alive;
+    }
+
+    /* calls f(id, bomb) for every alive bomb in increasing id order */
+    template <class F>
+    void for_each(F &&f) const {
+        auto straggler = stragglers.begin();
+        for (size_t index = 0; index < used; index++) {
+            BombId id = (BombId) (first_id + index);
+            for (; straggler != stragglers.end() && straggler->first < id; straggler++) {
+                f(straggler->first, to_bomb(straggler->second));
+            }
+            if (slot(index).alive) {
+                f(id, to_bomb(slot(index)));
+            }
+        }
+        for (; straggler != stragglers.end(); straggler++) {
+            f(straggler->first, to_bomb(straggler->second));
+        }
+    }
+
+    /* calls f(id, bomb) for every alive bomb whose timer reaches 0 this tick */
+    template <class F>
+    void for_each_due(F &&f) const {
+        for (BombId id : wheel[tick % wheel.size()]) {
+            if (std::optional<Bomb> bomb = find(id); bomb && bomb->timer == 0) {
+                f(id, *bomb);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        Position position;
+        uint32_t due_tick;
+        bool alive;
+    };
+
+    Slot &slot(size_t index) {
+        return ring[(head + index) & (ring.size() - 1)];
+    }
+
+    Slot const &slot(size_t index) const {
+        return ring[(head + index) & (ring.size() - 1)];
+    }
+
+    bool in_ring(BombId id) const {
+        return id >= first_id && id - first_id < used && slot(id - first_id).alive;
+    }
+
+    /* the widest span of ids the ring may cover */
+    size_t window_limit() const {
+        return std::max<size_t>(2 * (alive + 1), 16);
+    }
+
+    void pop_front() {
+        head = (head + 1) & (ring.size() - 1);
+        used--;
+        first_id++;
+    }
+
+    /* grows the ring to a power of two of at least size slots */
+    void reserve(size_t size) {
+        if (size <= ring.size()) {
+            return;
+        }
+        std::vector<Slot> grown(std::bit_ceil(std::max<size_t>(size, 16)));
+        for (size_t index = 0; index < used; index++) {
+            grown[index] = slot(index);
+        }
+        ring = std::move(grown);
+        head = 0;
+    }
+
+    Bomb to_bomb(Slot const &slot) const {
+        return {slot.position, (uint16_t) (slot.due_tick - tick)};
+    }
+
+    uint16_t bomb_timer = 0;
+    /* slots of ids first_id .. first_id + used - 1 start at ring[head] */
+    std::vector<Slot> ring;
+    size_t head = 0;
+    size_t used = 0;
+    std::vector<std::vector<BombId>> wheel = {{ }};
+    BombId first_id = 0;
+    size_t alive = 0;
+    uint32_t tick = 0;
+    /* alive bombs too far from the ids in the ring */
+    std::map<BombId, Slot> stragglers;
+};
+
+/* BombTracker is sent as the List<Bomb> of its alive bombs */
+template <ByteSink Sink>
+void serialize(BombTracker const &bombs, Sink &sb) {
+    size_t size = sizeof(uint32_t) + bombs.size() * fixed_wire_size_v<Bomb>;
+    std::byte *out = (std::byte *) sb.prepare(size).data();
+    out = encode_fixed((uint32_t) bombs.size(), out);
+    bombs.for_each([&out](BombId, Bomb const &bomb) {
+        out = encode_fixed(bomb, out);
+    });
+    sb.commit(size);
+}
+
+inline size_t serialized_size(BombTracker const &bombs) {
+    return sizeof(uint32_t) + bombs.size() * fixed_wire_size_v<Bomb>;
+}
+
+/* -------------------------------------------------------------------------
+   Per-player values keyed by PlayerId
+   ------------------------------------------------------------------------- */
+/* PlayerId is a single byte, so every player has a fixed slot in an array of
+   256 values and an occupancy bitmask marks the players present. Lookups and
+   updates never allocate, and iteration in PlayerId order walks the set bits
+   of the mask. */
+template <class V>
+class PlayerTable {
+public:
+    static constexpr size_t CAPACITY = (size_t) UINT8_MAX + 1;
+
+    void clear() {
+        for_each([this](PlayerId id, V const &) { values[id] = V { }; });
+        occupied = { };
+    }
+
+    /* like std::map::operator[], inserts a value-initialized V if id is absent */
+    V &operator[](PlayerId id) {
+        if (!contains(id)) {
+            occupied[id / 64] |= (uint64_t) 1 << (id % 64);
+            values[id] = V { };
+        }
+        return values[id];
+    }
+
+    bool contains(PlayerId id) const {
+        return occupied[id / 64] >> (id % 64) & 1;
+    }
+
+    V const *find(PlayerId id) const {
+        return contains(id) ? &values[id] : nullptr;
+    }
+
+    size_t size() const {
+        size_t count = 0;
+        for (uint64_t word : occupied) {
+            count += (size_t) std::popcount(word);
+        }
+        return count;
+    }
+
+    /* calls f(id, value) for every player present in increasing id order */
+    template <class F>
+    void for_each(F &&f) const {
+        for (size_t word = 0; word < occupied.size(); word++) {
+            for (uint64_t bits = occupied[word]; bits != 0; bits &= bits - 1) {
+                PlayerId id = (PlayerId) (64 * word + (size_t) std::countr_zero(bits));
+                f(id, values[id]);
+            }
+        }
+    }
+
+private:
+    std::array<V, CAPACITY> values = { };
+    std::array<uint64_t, CAPACITY / 64> occupied = { };
+};
+
+/* PlayerTable is sent as Map<PlayerId, V> */
+template <class V, ByteSink Sink>
+void serialize(PlayerTable<V> const &table, Sink &sb) {
+    if constexpr (FixedWire<V>) {
+        size_t size = serialized_size(table);
+        std::byte *out = (std::byte *) sb.prepare(size).data();
+        out = encode_fixed((uint32_t) table.size(), out);
+        table.for_each([&out](PlayerId id, V const &value) {
+            out = encode_fixed(id, out);
+            out = encode_fixed(value, out);
+        });
+        sb.commit(size);
+    }
+    else {
+        serialize((uint32_t) table.size(), sb);
+        table.for_each([&sb](PlayerId id, V const &value) {
+            serialize(id, sb);
+            serialize(value, sb);
+        });
+    }
+}
+
+template <class V>
+size_t serialized_size(PlayerTable<V> const &table) {
+    size_t size = sizeof(uint32_t);
+    if constexpr (FixedWire<V>) {
+        size += table.size() * (sizeof(PlayerId) + fixed_wire_size_v<V>);
+    }
+    else {
+        table.for_each([&size](PlayerId, V const &value) {
+            size += sizeof(PlayerId) + serialized_size(value);
+        });
+    }
+    return size;
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Time robots-server spends playing a turn, which encodes it once, and
+# sending it to 1 to 1000 observers on loopback: two headless bots play,
+# the other sessions watch.
+cmake ..
+make
+ulimit -n 4096
+PORT=10112
+for OBSERVERS in 1 10 100 1000; do
+    echo "$OBSERVERS observers:"
+    ./robots-server -b 5 -c 2 -d 20 -e 3 -k 50 -l 250 -n bench -p $PORT -s 1 -x 40 -y 40 \
+        --max-clients $((OBSERVERS + 2)) --report-turns > server.log &
+    SERVER=$!
+    sleep 0.5
+    ./robots-client --headless --bot avoid --sessions $((OBSERVERS + 2)) --threads 4 \
+        -n bench -s localhost:$PORT > /dev/null &
+    CLIENTS=$!
+    until grep -q "game ended" server.log 2> /dev/null; do
+        sleep 0.5
+    done
+    cat server.log
+    kill $CLIENTS $SERVER
+    wait $CLIENTS $SERVER 2> /dev/null
+done
+rm -f server.log
@@ -1,13 +1,25 @@
 #include <boost/program_options.hpp>
+#include <sys/socket.h>
 
+#include <atomic>
+#include <fstream>
+#include <functional>
 #include <iostream>
-#include "structures.hpp"
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include "board.hpp"
 
 using namespace std;
 using boost::asio::co_spawn;
 using boost::asio::detached;
 using boost::asio::ip::udp;
 using boost::asio::ip::tcp;
+using boost::asio::redirect_error;
+using boost::asio::steady_timer;
+using SessionStrand = boost::asio::strand<boost::asio::io_context::executor_type>;
+using chrono::steady_clock;
 
 namespace po = boost::program_options;
 
@@ -25,8 +37,149 @@ struct Client {
     bool in_game = false;
     bool join_request_sent = false;
 
-    map<BombId, Bomb> bombs;
-    set<Position> blocks;
+    /* Game snapshots not sent because a later turn was applied first */
+    size_t snapshots_suppressed = 0;
+};
+
+/* Gui commands held back to send at most the latest one per turn; turn
+   windows start at Turn arrivals, whose interval is averaged over turns.
+   Until the interval is known the first command of a window is sent at once
+   and the latest of the later ones when the next Turn arrives. */
+struct InputCoalescing {
+    optional<ClientMessageServer> pending;
+    /* a command was already sent in the current turn window */
+    bool window_used = false;
+    steady_clock::time_point last_turn;
+    steady_clock::duration turn_interval = steady_clock::duration::zero();
+};
+
+/* Lobby as aggregated by the client, fields are sent to gui as those of Lobby */
+struct LobbyState {
+    using wire_type = Lobby;
+
+    string server_name;
+    uint8_t players_count;
+    uint16_t size_x;
+    uint16_t size_y;
+    uint16_t game_length;
+    uint16_t explosion_radius;
+    uint16_t bomb_timer;
+    PlayerTable<Player> players;
+};
+static_assert(boost::pfr::tuple_size_v<LobbyState> == boost::pfr::tuple_size_v<Lobby>);
+
+/* Game as aggregated by the client, fields are sent to gui as those of Game */
+struct GameState {
+    using wire_type = Game;
+
+    string server_name;
+    uint16_t size_x;
+    uint16_t size_y;
+    uint16_t game_length;
+    uint16_t turn;
+    PlayerTable<Player> players;
+    PlayerTable<Position> player_positions;
+    Board blocks;
+    BombTracker bombs;
+    ExplosionSet explosions;
+    PlayerTable<Score> scores;
+};
+static_assert(boost::pfr::tuple_size_v<GameState> == boost::pfr::tuple_size_v<Game>);
+
+/* Consecutive fields of GameState encoded together into one buffer; header
+   and players only change between games, the rest changes during turns */
+enum class GameSection : size_t {
+    HEADER,
+    TURN,
+    PLAYERS,
+    PLAYER_POSITIONS,
+    BLOCKS,
+    BOMBS,
+    EXPLOSIONS,
+    SCORES,
+    COUNT,
+};
+
+/* Game message for gui kept encoded by sections. A section is re-encoded only
+   after being marked dirty, and the datagram is sent as the sequence of all
+   section buffers, the first of which starts with the ClientMessageGui tag.
+   The size of the message is known before anything is written, and every
+   section reserves the size of its encoding, so sections only allocate when
+   they grow past their largest encoding so far. */
+class GameEncoder {
+public:
+    static constexpr size_t SECTIONS = (size_t) GameSection::COUNT;
+    /* index of the first GameState field of every section, and the end */
+    static constexpr array<size_t, SECTIONS + 1> FIRST_FIELD = {0, 4, 5, 6, 7, 8, 9, 10, 11};
+    static_assert(FIRST_FIELD[SECTIONS] == boost::pfr::tuple_size_v<GameState>);
+
+    void mark_dirty(GameSection section) {
+        dirty[(size_t) section] = true;
+    }
+
+    void mark_all_dirty() {
+        dirty.fill(true);
+    }
+
+    /* re-encodes dirty sections if the whole message fits in limit bytes,
+       returns the size of the whole message */
+    size_t encode(GameState const &game, size_t limit) {
+        array<size_t, SECTIONS> sizes;
+        [&]<size_t... S>(index_sequence<S...>) {
+            ((sizes[S] = dirty[S] ? section_size<S>(game) : sections[S].size()), ...);
+        }(make_index_sequence<SECTIONS>());
+        size_t size = 0;
+        for (size_t section_bytes : sizes) {
+            size += section_bytes;
+        }
+        if (size > limit) {
+            return size;
+        }
+
+        [&]<size_t... S>(index_sequence<S...>) {
+            (encode_section<S>(game, sizes[S]), ...);
+        }(make_index_sequence<SECTIONS>());
+        return size;
+    }
+
+    array<boost::asio::const_buffer, SECTIONS> buffers() const {
+        array<boost::asio::const_buffer, SECTIONS> result;
+        for (size_t s = 0; s < SECTIONS; s++) {
+            result[s] = sections[s].data();
+        }
+        return result;
+    }
+
+private:
+    template <size_t S>
+    static size_t section_size(GameState const &game) {
+        size_t size = S == (size_t) GameSection::HEADER ? sizeof(uint8_t) : 0;
+        [&]<size_t... I>(index_sequence<I...>) {
+            ((size += serialized_size(boost::pfr::get<FIRST_FIELD[S] + I>(game))), ...);
+        }(make_index_sequence<FIRST_FIELD[S + 1] - FIRST_FIELD[S]>());
+        return size;
+    }
+
+    template <size_t S>
+    void encode_section(GameState const &game, size_t size) {
+        if (!dirty[S]) {
+            return;
+        }
+        ByteBuffer &section = sections[S];
+        section.clear();
+        section.reserve(size);
+        if constexpr (S == (size_t) GameSection::HEADER) {
+            uint8_t code = (uint8_t) variant_index_v<ClientMessageGui, Game>;
+            serialize(code, section);
+        }
+        [&]<size_t... I>(index_sequence<I...>) {
+            (serialize(boost::pfr::get<FIRST_FIELD[S] + I>(game), section), ...);
+        }(make_index_sequence<FIRST_FIELD[S + 1] - FIRST_FIELD[S]>());
+        dirty[S] = false;
+    }
+
+    array<ByteBuffer, SECTIONS> sections;
+    array<bool, SECTIONS> dirty = { };
 };
 /* structure storing address and port as strings */
 struct sockaddrStr {
@@ -34,21 +187,85 @@ struct sockaddrStr {
     string port;
 };
 
+/* policies choosing the commands of a headless session */
+enum class BotPolicy {
+    Random,
+    Script,
+    Avoid,
+};
+
+/* time from sending a command to the arrival of the next Turn */
+struct TurnLatency {
+    size_t samples = 0;
+    steady_clock::duration total = steady_clock::duration::zero();
+    steady_clock::duration max = steady_clock::duration::zero();
+
+    void add(steady_clock::duration sample) {
+        samples++;
+        total += sample;
+        max = std::max(max, sample);
+    }
+};
+
+/* Sockets of a session connected to guis, absent in headless sessions. Every
+   datagram goes to all endpoints, the first of which is the gui the session
+   takes input from. With more than one endpoint the socket is a dual-stack
+   IPv6 one, IPv4 endpoints are mapped, and the message headers for sendmmsg
+   are prepared once, as only their payload changes between datagrams. */
+struct GuiLink {
+    /* sendmmsg sends at most that many messages per call */
+    static constexpr size_t MAX_BATCH = 1024;
+
+    GuiLink(SessionStrand const &strand, vector<udp::endpoint> endpoints)
+        : listen_socket(strand), socket(strand), endpoints(std::move(endpoints)) 
+    {
+        if (this->endpoints.size() == 1) {
+            socket.open(this->endpoints[0].protocol());
+            return;
+        }
+        socket.open(udp::v6());
+        socket.set_option(boost::asio::ip::v6_only(false));
+        for (udp::endpoint &endpoint : this->endpoints) {
+            if (endpoint.address().is_v4()) {
+                endpoint.address(boost::asio::ip::make_address_v6(
+                    boost::asio::ip::v4_mapped, endpoint.address().to_v4()));
+            }
+            mmsghdr message = { };
+            message.msg_hdr.msg_name = endpoint.data();
+            message.msg_hdr.msg_namelen = (socklen_t) endpoint.size();
+            messages.push_back(message);
+        }
+    }
+
+    udp::socket listen_socket;
+    udp::socket socket;
+    vector<udp::endpoint> endpoints;
+    vector<mmsghdr> messages;
+    vector<iovec> payload;
+    array<std::byte, MAX_UDP_DATA_SIZE> datagram_storage;
+    FixedBuffer<MAX_UDP_DATA_SIZE> datagram{datagram_storage};
+};
+
 /* -------------------------------------------------------------------------
    Global variables for less argument passing
    ------------------------------------------------------------------------- */
 po::variables_map program_params;
 boost::asio::streambuf UDP_buffer;
 
-Client client;
-Hello settings;
-Lobby lobby;
-Game game;
-
 sockaddrStr gui;
 sockaddrStr server;
 string player_name;
 string port;
+uint16_t max_turn_lag;
+bool coalesce_input;
+bool send_first_input;
+uint32_t turn_duration_ms;
+bool headless;
+BotPolicy bot_policy;
+vector<ClientMessageServer> bot_script;
+size_t sessions_count;
+size_t threads_count;
+vector<sockaddrStr> relays;
 
 /* -------------------------------------------------------------------------
    Parsing & helper functions
@@ -62,18 +279,82 @@ sockaddrStr get_sockaddr_str(string &str) {
     return addr_str;
 }
 
+/* reads one command per line: bomb, block, up, right, down or left; empty
+   lines and lines starting with # are skipped */
+vector<ClientMessageServer> read_bot_script(string const &path) {
+    ifstream file(path);
+    if (!file) {
+        throw invalid_argument("cannot open bot script " + path);
+    }
+    vector<ClientMessageServer> script;
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (line == "bomb") {
+            script.push_back(PlaceBomb { });
+        }
+        else if (line == "block") {
+            script.push_back(PlaceBlock { });
+        }
+        else if (line == "up") {
+            script.push_back(Move { .direction = Direction::Up });
+        }
+        else if (line == "right") {
+            script.push_back(Move { .direction = Direction::Right });
+        }
+        else if (line == "down") {
+            script.push_back(Move { .direction = Direction::Down });
+        }
+        else if (line == "left") {
+            script.push_back(Move { .direction = Direction::Left });
+        }
+        else {
+            throw invalid_argument("unknown command in bot script: " + line);
+        }
+    }
+    if (script.empty()) {
+        throw invalid_argument("empty bot script " + path);
+    }
+    return script;
+}
+
 bool process_command_line(int argc, char** argv) {
     string gui_sockaddr_str;
     string server_sockaddr_str;
     uint16_t port_u16;
+    string bot_policy_name;
+    vector<string> relay_sockaddr_strs;
 
     try {
         po::options_description desc("Allowed options");
         desc.add_options()
-            ("gui-address,d", po::value<string>(&gui_sockaddr_str)->required(), "gui address:port")
+            ("gui-address,d", po::value<string>(&gui_sockaddr_str), "gui address:port")
             ("help,h", "help message")
             ("player-name,n", po::value<string>(&player_name)->required(), "player name")
-            ("port,p", po::value<uint16_t>(&port_u16)->required(), "port for comms from gui")
+            ("port,p", po::value<uint16_t>(&port_u16), "port for comms from gui")
+            ("max-turn-lag,l", po::value<uint16_t>(&max_turn_lag)->default_value(0),
+                "turns applied at most before sending Game to gui while more server data is "
+                "buffered, 0 sends Game after every turn")
+            ("coalesce-input", po::bool_switch(&coalesce_input),
+                "send only the latest gui command once per turn")
+            ("send-first-input", po::bool_switch(&send_first_input),
+                "with --coalesce-input, send the first command of a turn immediately")
+            ("turn-duration", po::value<uint32_t>(&turn_duration_ms)->default_value(0),
+                "turn duration in milliseconds for --coalesce-input, 0 measures it from turns")
+            ("headless", po::bool_switch(&headless),
+                "play without gui, commands are chosen by --bot")
+            ("bot", po::value<string>(&bot_policy_name)->default_value("random"),
+                "headless policy: random, avoid (bomb-avoiding) or a path to a script file")
+            ("sessions", po::value<size_t>(&sessions_count)->default_value(1),
+                "number of sessions, named player-name-<index> if more than one; with a gui, "
+                "session i listens on port + i and sends to gui and relay ports + i")
+            ("threads", po::value<size_t>(&threads_count)->default_value(1),
+                "number of threads running the sessions")
+            ("relay-to", po::value<vector<string>>(&relay_sockaddr_strs)->composing(),
+                "another gui or multicast group address:port receiving the same datagrams "
+                "as the gui, may be repeated")
             ("server-address,s", po::value<string>(&server_sockaddr_str)->required(), 
                 "server address:port");
 
@@ -85,6 +366,33 @@ bool process_command_line(int argc, char** argv) {
         }
 
         po::notify(program_params);
+
+        /* gui options are only required when there is a gui */
+        if (!headless) {
+            if (!program_params.count("gui-address")) {
+                throw po::required_option("--gui-address");
+            }
+            if (!program_params.count("port")) {
+                throw po::required_option("--port");
+            }
+            if (sessions_count > (size_t) UINT16_MAX + 1 - port_u16) {
+                throw invalid_argument("ports of the sessions above 65535");
+            }
+        }
+        if (sessions_count == 0 || threads_count == 0) {
+            throw invalid_argument("--sessions and --threads must be positive");
+        }
+
+        if (bot_policy_name == "random") {
+            bot_policy = BotPolicy::Random;
+        }
+        else if (bot_policy_name == "avoid") {
+            bot_policy = BotPolicy::Avoid;
+        }
+        else {
+            bot_policy = BotPolicy::Script;
+            bot_script = read_bot_script(bot_policy_name);
+        }
     }
     catch(exception &e) {
         cerr << "error: " << e.what() << "\n";
@@ -95,14 +403,185 @@ bool process_command_line(int argc, char** argv) {
         return false;
     }
 
-    gui = get_sockaddr_str(gui_sockaddr_str);
+    if (!headless) {
+        gui = get_sockaddr_str(gui_sockaddr_str);
+        port = to_string(port_u16);
+        for (string &relay_sockaddr_str : relay_sockaddr_strs) {
+            relays.push_back(get_sockaddr_str(relay_sockaddr_str));
+        }
+    }
     server = get_sockaddr_str(server_sockaddr_str);
-    port = to_string(port_u16);
 
     return true;
 }
 
-void setup() {
+/* encodes message for gui straight from client state, without copying it into
+   a ClientMessageGui; returns false if it would not fit in one datagram */
+template <class T>
+bool encode_gui_message(T const &message, FixedBuffer<MAX_UDP_DATA_SIZE> &datagram) {
+    size_t message_size = serialized_size_as<ClientMessageGui>(message);
+    if (message_size > MAX_UDP_DATA_SIZE) {
+        cerr << "error: message of " << message_size << " bytes does not fit "
+             << "in a datagram to gui, NOT SENT\n";
+        return false;
+    }
+    datagram.clear();
+    serialize_as<ClientMessageGui>(message, datagram);
+    return true;
+}
+
+/* -------------------------------------------------------------------------
+   State and coroutines of one connection to the server
+   ------------------------------------------------------------------------- */
+/* A session aggregates the state of one server connection and forwards it to
+   its gui, or, when headless, plays by itself with the bot policy. Sessions
+   share the io_context, so one process can run many of them. All sockets and
+   coroutines of a session run on its strand, so its state is never touched
+   by two threads at once while different sessions run in parallel. */
+class ClientSession {
+public:
+    ClientSession(boost::asio::io_context &io_context, size_t index, string name, unsigned seed)
+        : index(index),
+          name(std::move(name)),
+          strand(boost::asio::make_strand(io_context)),
+          server_socket(strand),
+          input_timer(strand),
+          random(seed) {}
+
+    void connect(tcp::resolver::results_type const &server_endpoints) {
+        boost::asio::connect(server_socket, server_endpoints);
+        server_socket.set_option(tcp::no_delay(true)); // set the TCP_NODELAY flag
+        local_address = address_str(server_socket.local_endpoint());
+    }
+
+    /* binds the socket for receiving data from gui and prepares sending to it */
+    void open_gui(uint16_t listen_port, vector<udp::endpoint> gui_endpoints) {
+        gui_link = make_unique<GuiLink>(strand, std::move(gui_endpoints));
+        gui_link->listen_socket.open(boost::asio::ip::udp::v6());
+        gui_link->listen_socket.bind({boost::asio::ip::udp::v6(), listen_port});
+    }
+
+    /* on_finished is called on the strand once all coroutines of the session
+       have ended, with whether one of them failed */
+    void start(function<void(bool)> on_finished) {
+        this->on_finished = std::move(on_finished);
+        if (gui_link) {
+            spawn(gui_listener());
+            if (coalesce_input) {
+                spawn(input_flusher());
+            }
+        }
+        spawn(server_listener());
+    }
+
+private:
+    void spawn(awaitable<void> coroutine);
+    void finish_coroutine(exception_ptr error);
+    void stop();
+    void setup();
+    void accept_player(AcceptedPlayer &accepted_player);
+    void note_turn_arrival(bool buffered);
+    steady_clock::duration input_interval() const;
+    steady_clock::time_point next_input_flush();
+    bool input_flush_due() const;
+    bool encode_game_message();
+    void update_bombs_explosions_blocks(vector<BombExplodedView> &bombs_exploded, 
+        vector<BlockPlaced> &blocks_placed, 
+        uint16_t current_turn);
+    ClientMessageServer bot_command();
+    ClientMessageServer random_command();
+    ClientMessageServer avoiding_command();
+    void report_latency();
+
+    awaitable<void> gui_listener();
+    awaitable<void> input_flusher();
+    awaitable<void> flush_game_snapshot(uint16_t &turns_unsent);
+    awaitable<void> send_to_server(ClientMessageServer const &message);
+    awaitable<void> send_to_gui(span<const boost::asio::const_buffer> buffers);
+    awaitable<void> server_listener();
+
+    size_t index;
+    string name;
+    SessionStrand strand;
+    function<void(bool)> on_finished;
+    size_t coroutines_running = 0;
+    bool stopped = false;
+    bool failed = false;
+    Client client;
+    Hello settings;
+    LobbyState lobby;
+    GameState game;
+    GameEncoder game_encoder;
+    InputCoalescing input;
+
+    tcp::socket server_socket;
+    /* this end of the connection as the server shows it in Player */
+    string local_address;
+    unique_ptr<GuiLink> gui_link;
+    steady_timer input_timer;
+    /* messages waiting for the write to the server in progress */
+    vector<ClientMessageServer> server_outbox;
+    bool server_writing = false;
+    boost::asio::streambuf send_streambuf;
+
+    /* headless play */
+    minstd_rand random;
+    optional<PlayerId> own_id;
+    bool own_address_matched = false;
+    size_t script_position = 0;
+    optional<steady_clock::time_point> command_sent;
+    TurnLatency latency;
+};
+
+/* every coroutine of the session ends in finish_coroutine, on the strand */
+void ClientSession::spawn(awaitable<void> coroutine) {
+    coroutines_running++;
+    co_spawn(strand, std::move(coroutine), boost::asio::bind_executor(strand,
+        [this](exception_ptr error) {
+            finish_coroutine(error);
+        }));
+}
+
+/* The first coroutine to end, failed or not, stops the session, which ends
+   the other coroutines; their errors from the closed sockets are not
+   reported. Other sessions keep running. */
+void ClientSession::finish_coroutine(exception_ptr error) {
+    if (error && !stopped) {
+        failed = true;
+        ostringstream line;
+        line << "error: session " << index << " (" << name << "): ";
+        try {
+            rethrow_exception(error);
+        }
+        catch (exception &e) {
+            line << e.what() << "\n";
+        }
+        catch (...) {
+            line << "exception of unknown type\n";
+        }
+        cerr << line.str() << flush;
+    }
+    stop();
+    if (--coroutines_running == 0) {
+        on_finished(failed);
+    }
+}
+
+void ClientSession::stop() {
+    if (stopped) {
+        return;
+    }
+    stopped = true;
+    boost::system::error_code ignored;
+    server_socket.close(ignored);
+    if (gui_link) {
+        gui_link->listen_socket.close(ignored);
+        gui_link->socket.close(ignored);
+    }
+    input_timer.cancel();
+}
+
+void ClientSession::setup() {
     lobby.server_name = settings.server_name;
     lobby.players_count = settings.players_count;
     lobby.size_x = settings.size_x;
@@ -119,143 +598,339 @@ void setup() {
     game.turn = 0;
     game.players.clear();
     game.player_positions.clear();
-    game.blocks.clear();
-    game.bombs.clear();
+    game.blocks.reset(settings.size_x, settings.size_y);
+    game.bombs.reset(settings.bomb_timer);
     game.explosions.clear();
     game.scores.clear();
+    game_encoder.mark_all_dirty();
+    input.pending.reset();
+    input.window_used = false;
+    input.last_turn = { };
+    own_id.reset();
+    own_address_matched = false;
+    command_sent.reset();
 
     client.in_lobby = false;
     client.in_game = false;
     client.join_request_sent = false;
-    client.bombs.clear();
-    client.blocks.clear();
 }
 
-void accept_player(AcceptedPlayer &accepted_player) {
+/* Names may repeat, so of the players named as the session the one at the
+   session's own address wins. Behind a NAT the server sees another address
+   and the first player of the name is taken, which is only right when the
+   names of the players are unique. */
+void ClientSession::accept_player(AcceptedPlayer &accepted_player) {
+    if (accepted_player.player.name == name && !own_address_matched) {
+        bool own_address = accepted_player.player.address == local_address;
+        if (!own_id || own_address) {
+            own_id = accepted_player.id;
+            own_address_matched = own_address;
+        }
+    }
     lobby.players[accepted_player.id] = accepted_player.player;
-    game.players[accepted_player.id] = accepted_player.player;
+    game.players[accepted_player.id] = std::move(accepted_player.player);
     game.scores[accepted_player.id] = (Score) 0;
+    game_encoder.mark_dirty(GameSection::PLAYERS);
+    game_encoder.mark_dirty(GameSection::SCORES);
 }
 
-void update_client_bomb_timers() {
-    for (auto &[id, bomb] : client.bombs) {
-        bomb.timer--;
+/* records the arrival of a Turn, which starts a new input window; turns
+   that arrived buffered together do not count towards the interval */
+void ClientSession::note_turn_arrival(bool buffered) {
+    steady_clock::time_point now = steady_clock::now();
+    if (!buffered && input.last_turn != steady_clock::time_point { }) {
+        steady_clock::duration sample = now - input.last_turn;
+        input.turn_interval = input.turn_interval == steady_clock::duration::zero()
+            ? sample
+            : (7 * input.turn_interval + sample) / 8;
     }
+    input.last_turn = now;
+    input.window_used = false;
+    /* the flusher sends a command held back from the last window if it is
+       due now, or waits for the flush of the new one */
+    input_timer.cancel();
 }
 
-bool validate_position(SignedPosition &position) {
-return (position.x >= 0 && position.x < settings.size_x &&
-        position.y >= 0 && position.y < settings.size_y);
+/* returns the turn interval, or zero until a Turn of this game arrived and
+   the interval is given by --turn-duration or measured */
+steady_clock::duration ClientSession::input_interval() const {
+    if (input.last_turn == steady_clock::time_point { }) {
+        return steady_clock::duration::zero();
+    }
+    return turn_duration_ms > 0 ? chrono::milliseconds(turn_duration_ms) : input.turn_interval;
+}
+
+/* held back input is flushed in the middle of the turn window, which leaves
+   half a turn for the command to reach the server before the turn ends */
+steady_clock::time_point ClientSession::next_input_flush() {
+    steady_clock::duration interval = input_interval();
+    if (interval == steady_clock::duration::zero()) {
+        return steady_clock::time_point::max();
+    }
+    steady_clock::time_point now = steady_clock::now();
+    steady_clock::time_point flush = input.last_turn + interval / 2;
+    if (flush <= now) {
+        flush += ((now - flush) / interval + 1) * interval;
+    }
+    return flush;
+}
+
+/* held back input is sent at once if no command was sent in the current
+   window yet, before the interval is known or with --send-first-input */
+bool ClientSession::input_flush_due() const {
+    return client.in_game && input.pending && !input.window_used
+        && (send_first_input || input_interval() == steady_clock::duration::zero());
+}
+
+/* brings the cached Game encoding up to date with the client state; returns
+   false if it would not fit in one datagram */
+bool ClientSession::encode_game_message() {
+    size_t message_size = game_encoder.encode(game, MAX_UDP_DATA_SIZE);
+    if (message_size > MAX_UDP_DATA_SIZE) {
+        cerr << "error: message of " << message_size << " bytes does not fit "
+             << "in a datagram to gui, NOT SENT\n";
+        return false;
+    }
+    return true;
 }
 
-void update_bombs_explosions_blocks(vector<BombExploded> &bombs_exploded, 
+void ClientSession::update_bombs_explosions_blocks(vector<BombExplodedView> &bombs_exploded, 
     vector<BlockPlaced> &blocks_placed, 
-    uint16_t &current_turn) 
+    uint16_t current_turn) 
 {
-    set<Position> explosions = { };
     set<Position> all_blocks_destroyed = { };
     set<PlayerId> all_robots_destroyed = { };
 
-    for (BombExploded const &exploded : bombs_exploded) {
-        Bomb bomb = client.bombs[exploded.id];
-        vector<SignedPosition> explosion_direction = {{0, 1}, {1, 0}, {0, -1}, {-1, 0}};
-
-        for (SignedPosition direction : explosion_direction) {
-            SignedPosition check = {bomb.position.x, bomb.position.y};
-            for (
-                uint16_t radius = 0; 
-                radius <= settings.explosion_radius && validate_position(check);
-                radius++)
-            {
-                Position checked = {(uint16_t) check.x, (uint16_t) check.y};
-                explosions.insert(checked);
-                if (client.blocks.contains(checked)) {
-                    break;
-                }
-                check += direction;
-            }
+    /* explosions are only those of the current turn */
+    if (game.explosions.size() > 0 || !bombs_exploded.empty()) {
+        game_encoder.mark_dirty(GameSection::EXPLOSIONS);
+        game_encoder.mark_dirty(GameSection::BOMBS);
+    }
+    game.explosions.clear();
+
+    for (BombExplodedView const &exploded : bombs_exploded) {
+        Bomb bomb = game.bombs.find(exploded.id).value_or(Bomb { });
+
+        if (game.blocks.on_board(bomb.position)) {
+            game.explosions.add(game.blocks.explosion(bomb.position, settings.explosion_radius));
         }
 
-        for (PlayerId const &id : exploded.robots_destroyed) {
+        for (PlayerId id : exploded.robots_destroyed) {
             all_robots_destroyed.insert(id);
         }
-        for (Position const &position : exploded.blocks_destroyed) {
+        for (Position position : exploded.blocks_destroyed) {
             all_blocks_destroyed.insert(position);
         }
-        client.bombs.erase(exploded.id);
-        
+        game.bombs.explode(exploded.id);
     }
 
-    /* update blocks and copy the blocks from client to game */
+    /* update blocks, the board is sent to gui as it is */
+    bool blocks_changed = false;
     for (Position const &position : all_blocks_destroyed) {
-        client.blocks.erase(position);
+        blocks_changed |= game.blocks.erase(position);
     }
 
     for (BlockPlaced const &block : blocks_placed) {
-        client.blocks.insert(block.position);
+        blocks_changed |= game.blocks.insert(block.position);
     }
-    game.blocks.assign(client.blocks.begin(), client.blocks.end());
 
-    /* copy the bombs from client to game */
-    game.bombs.clear();
-    for (auto const &[id, bomb] : client.bombs) {
-        game.bombs.push_back(bomb);
+    if (blocks_changed) {
+        game_encoder.mark_dirty(GameSection::BLOCKS);
     }
 
-    /* copy the explosions to game */
-    game.explosions.assign(explosions.begin(), explosions.end());
-
     /* increment the scores of players whose robots were destroyed */
     for (PlayerId const &id : all_robots_destroyed) {
         game.scores[id]++;
     }
 
+    if (!all_robots_destroyed.empty()) {
+        game_encoder.mark_dirty(GameSection::SCORES);
+    }
+
     /* update game turn */
     game.turn = current_turn;
+    game_encoder.mark_dirty(GameSection::TURN);
 }
 
 /* -------------------------------------------------------------------------
-   Coroutine function for communication from gui to server
+   Bot policies of headless sessions
    ------------------------------------------------------------------------- */
-awaitable<void> gui_listener(tcp::socket &server_socket, udp::socket &client_socket) {
-    boost::asio::streambuf read_streambuf;
-    boost::asio::streambuf send_streambuf;
+ClientMessageServer ClientSession::bot_command() {
+    switch (bot_policy) {
+        case BotPolicy::Script:
+            return bot_script[script_position++ % bot_script.size()];
+        case BotPolicy::Avoid:
+            return avoiding_command();
+        default:
+            return random_command();
+    }
+}
 
-    auto read_UDP = [&](void* arg, size_t size) -> awaitable<void> {
-        read_streambuf.sgetn((char *) arg, size);
-        co_return;
+/* a random walk, placing a bomb or a block every few turns */
+ClientMessageServer ClientSession::random_command() {
+    switch (random() % 8) {
+        case 0:
+            return PlaceBomb { };
+        case 1:
+            return PlaceBlock { };
+        default:
+            return Move { .direction = (Direction) (random() % 4) };
+    }
+}
+
+/* Stays out of the explosions of the bombs on the board as computed from the
+   client's own board, moving to a free neighbour out of them if possible;
+   when safe, places a bomb now and then and otherwise walks randomly. */
+ClientMessageServer ClientSession::avoiding_command() {
+    const Position *position = own_id ? game.player_positions.find(*own_id) : nullptr;
+    if (!position) {
+        return random_command();
+    }
+
+    vector<ExplosionCross> crosses;
+    game.bombs.for_each([&](BombId, Bomb const &bomb) {
+        if (game.blocks.on_board(bomb.position)) {
+            crosses.push_back(game.blocks.explosion(bomb.position, settings.explosion_radius));
+        }
+    });
+    auto in_danger = [&crosses](Position cell) {
+        for (ExplosionCross const &cross : crosses) {
+            if ((cell.x == cross.center.x && cross.down <= cell.y && cell.y <= cross.up)
+                || (cell.y == cross.center.y && cross.left <= cell.x && cell.x <= cross.right)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    /* free neighbours, the safe ones first, starting from a random direction */
+    vector<Direction> free_directions;
+    vector<Direction> safe_directions;
+    uint8_t first = (uint8_t) (random() % 4);
+    for (uint8_t d = 0; d < 4; d++) {
+        Direction direction = (Direction) ((first + d) % 4);
+        Position next = *position;
+        switch (direction) {
+            case Direction::Up:
+                next.y++;
+                break;
+            case Direction::Right:
+                next.x++;
+                break;
+            case Direction::Down:
+                next.y--;
+                break;
+            case Direction::Left:
+                next.x--;
+                break;
+        }
+        if (!game.blocks.on_board(next) || game.blocks.contains(next)) {
+            continue;
+        }
+        free_directions.push_back(direction);
+        if (!in_danger(next)) {
+            safe_directions.push_back(direction);
+        }
+    }
+
+    if (!in_danger(*position) && random() % 4 == 0) {
+        return PlaceBomb { };
+    }
+    if (!safe_directions.empty()) {
+        return Move { .direction = safe_directions.front() };
+    }
+    if (!free_directions.empty()) {
+        return Move { .direction = free_directions.front() };
+    }
+    return PlaceBlock { };
+}
+
+/* sessions that only observed the game have no latency to report */
+void ClientSession::report_latency() {
+    if (!own_id) {
+        return;
+    }
+    auto microseconds = [](steady_clock::duration duration) {
+        return chrono::duration_cast<chrono::microseconds>(duration).count();
     };
+    /* written at once, as sessions on other threads report too */
+    ostringstream line;
+    line << name << ": " << latency.samples << " turns, turn latency avg "
+         << (latency.samples > 0 ? microseconds(latency.total) / (long) latency.samples : 0)
+         << " us, max " << microseconds(latency.max) << " us\n";
+    cout << line.str() << flush;
+    latency = { };
+}
+
+/* -------------------------------------------------------------------------
+   Coroutine function for communication from gui to server
+   ------------------------------------------------------------------------- */
+/* Datagrams waiting on the socket are all received with one recvmmsg into a
+   slab of small slots, as valid gui messages take at most 2 bytes; a longer
+   datagram is truncated and reported as invalid. Of one batch only the last
+   valid command is forwarded, the server only uses the last one of a turn. */
+awaitable<void> ClientSession::gui_listener() {
+    static constexpr size_t BATCH = 64;
+    static constexpr size_t SLOT_SIZE = 8;
+    array<array<std::byte, SLOT_SIZE>, BATCH> slots;
+    array<iovec, BATCH> slot_iovecs;
+    array<mmsghdr, BATCH> headers;
+    for (size_t i = 0; i < BATCH; i++) {
+        slot_iovecs[i] = {slots[i].data(), SLOT_SIZE};
+    }
 
     for (;;) {
-        /* ensure both streambufs are empty before operating on them */
-        read_streambuf.consume(read_streambuf.size());
-        send_streambuf.consume(send_streambuf.size());
-        GuiMessageClient gui_message;
-        try {
-            boost::asio::streambuf::mutable_buffers_type mut_read_streambuf = 
-                read_streambuf.prepare(MAX_UDP_DATA_SIZE);
-            size_t receive_size = 
-                co_await client_socket.async_receive(mut_read_streambuf, use_awaitable);
-            read_streambuf.commit(receive_size);
-            co_await deserialize(gui_message, read_UDP);
-            if (read_streambuf.in_avail()) {
-                throw length_error("leftover message bytes from gui, IGNORED\n");
-            }
+        co_await gui_link->listen_socket.async_wait(udp::socket::wait_read, use_awaitable);
+        for (size_t i = 0; i < BATCH; i++) {
+            headers[i] = { };
+            headers[i].msg_hdr.msg_iov = &slot_iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
         }
-        catch(exception &e) {
-            cerr << "error: " << e.what() << " from gui, IGNORED\n";
+        int received = recvmmsg(gui_link->listen_socket.native_handle(), headers.data(), 
+            (unsigned int) BATCH, MSG_DONTWAIT, nullptr);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                cerr << "error: " << strerror(errno) << " from gui, IGNORED\n";
+            }
             continue;
         }
-        catch(...) {
-            cerr << "Exception of unknown type!\n";
+
+        optional<GuiMessageClient> latest_message;
+        for (size_t i = 0; i < (size_t) received; i++) {
+            size_t receive_size = headers[i].msg_len;
+            GuiMessageClient gui_message;
+            try {
+                if (headers[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    throw length_error("leftover message bytes");
+                }
+                optional<size_t> decoded_size = 
+                    try_decode(gui_message, std::span(slots[i].data(), receive_size));
+                if (!decoded_size) {
+                    throw length_error("incomplete message");
+                }
+                if (*decoded_size != receive_size) {
+                    throw length_error("leftover message bytes");
+                }
+            }
+            catch(exception &e) {
+                cerr << "error: " << e.what() << " from gui, IGNORED\n";
+                continue;
+            }
+            catch(...) {
+                cerr << "Exception of unknown type!\n";
+                continue;
+            }
+            latest_message = gui_message;
+        }
+        if (!latest_message) {
             continue;
         }
+        GuiMessageClient &gui_message = *latest_message;
 
         if (client.in_lobby && !client.join_request_sent) {
-            ClientMessageServer join = Join { .name = player_name };
-            serialize(join, send_streambuf);
-            co_await server_socket.async_send(send_streambuf.data(), use_awaitable);
+            ClientMessageServer join = Join { .name = name };
             client.join_request_sent = true;
+            co_await send_to_server(join);
         }
         
         ClientMessageServer client_message;
@@ -272,8 +947,16 @@ awaitable<void> gui_listener(tcp::socket &server_socket, udp::socket &client_soc
                 }
             }, gui_message);
 
-            serialize(client_message, send_streambuf);
-            co_await server_socket.async_send(send_streambuf.data(), use_awaitable);
+            /* the flusher sends the latest command, woken if it is due at once */
+            if (coalesce_input) {
+                input.pending = client_message;
+                if (input_flush_due()) {
+                    input_timer.cancel();
+                }
+                continue;
+            }
+
+            co_await send_to_server(client_message);
         }
     }
 
@@ -281,80 +964,182 @@ awaitable<void> gui_listener(tcp::socket &server_socket, udp::socket &client_soc
 }
 
 /* -------------------------------------------------------------------------
-   Coroutine function for communication from server to gui
+   Coroutine function sending coalesced gui commands to server
    ------------------------------------------------------------------------- */
-awaitable<void> server_listener(
-    tcp::socket &server_socket,
-    udp::socket &gui_socket,
-    udp::endpoint &gui_endpoint) 
-{
-    boost::asio::streambuf read_streambuf;
-    boost::asio::streambuf send_streambuf;
+awaitable<void> ClientSession::input_flusher() {
+    while (!stopped) {
+        bool mid_window = false;
+        if (!input_flush_due()) {
+            input_timer.expires_at(next_input_flush());
+            boost::system::error_code ec;
+            co_await input_timer.async_wait(redirect_error(use_awaitable, ec));
+            /* otherwise cancelled by gui_listener, note_turn_arrival or stop */
+            mid_window = !ec;
+            if (stopped) {
+                break;
+            }
+        }
 
-    auto read_TCP = [&](void* arg, size_t size) -> awaitable<void> {
-        co_await boost::asio::async_read(
-            server_socket, 
-            read_streambuf, 
-            boost::asio::transfer_exactly(size), 
-            use_awaitable
-        );
-        read_streambuf.sgetn((char *) arg, size);
-    };
+        bool due = input_flush_due()
+            || (mid_window && client.in_game && input.pending && !input.window_used);
+        if (due) {
+            ClientMessageServer message = *input.pending;
+            input.pending.reset();
+            input.window_used = true;
+            co_await send_to_server(message);
+        }
+    }
+}
 
-    for (;;) {
-        read_streambuf.consume(read_streambuf.size());
+/* -------------------------------------------------------------------------
+   Coroutine functions for communication from server to gui
+   ------------------------------------------------------------------------- */
+/* sends the Game snapshot held back for the turns applied since the last one */
+awaitable<void> ClientSession::flush_game_snapshot(uint16_t &turns_unsent) {
+    turns_unsent = 0;
+    if (gui_link && encode_game_message()) {
+        array<boost::asio::const_buffer, GameEncoder::SECTIONS> buffers = game_encoder.buffers();
+        co_await send_to_gui(buffers);
+    }
+}
+
+/* Every coroutine of the session writes to the server through here, so two
+   writes never overlap on the stream: a message sent while another one is
+   being written is queued, and the coroutine writing sends it next. */
+awaitable<void> ClientSession::send_to_server(ClientMessageServer const &message) {
+    server_outbox.push_back(message);
+    if (server_writing) {
+        co_return;
+    }
+    server_writing = true;
+    for (size_t i = 0; i < server_outbox.size(); i++) {
         send_streambuf.consume(send_streambuf.size());
-        
-        ServerMessageClient server_message;
-        co_await deserialize(server_message, read_TCP);
+        serialize(server_outbox[i], send_streambuf);
+        co_await boost::asio::async_write(server_socket, send_streambuf.data(), use_awaitable);
+    }
+    server_outbox.clear();
+    server_writing = false;
+}
+
+/* sends the datagram made of buffers to every gui endpoint */
+awaitable<void> ClientSession::send_to_gui(span<const boost::asio::const_buffer> buffers) {
+    if (gui_link->endpoints.size() == 1) {
+        co_await gui_link->socket.async_send_to(buffers, gui_link->endpoints[0], use_awaitable);
+        co_return;
+    }
+
+    vector<iovec> &payload = gui_link->payload;
+    payload.clear();
+    for (boost::asio::const_buffer const &buffer : buffers) {
+        payload.push_back({(void *) buffer.data(), buffer.size()});
+    }
+    vector<mmsghdr> &messages = gui_link->messages;
+    for (mmsghdr &message : messages) {
+        message.msg_hdr.msg_iov = payload.data();
+        message.msg_hdr.msg_iovlen = payload.size();
+    }
 
-        ClientMessageGui client_message;
-        bool send_message = false;
+    size_t sent = 0;
+    while (sent < messages.size()) {
+        unsigned int batch = (unsigned int) min(messages.size() - sent, GuiLink::MAX_BATCH);
+        int result = sendmmsg(gui_link->socket.native_handle(), messages.data() + sent, batch, 
+            MSG_DONTWAIT);
+        if (result >= 0) {
+            sent += (size_t) result;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await gui_link->socket.async_wait(udp::socket::wait_write, use_awaitable);
+        }
+        else {
+            /* the failing endpoint loses this datagram, the others still get it */
+            cerr << "error: " << strerror(errno) << " sending to gui " 
+                 << gui_link->endpoints[sent] << ", NOT SENT\n";
+            sent++;
+        }
+    }
+}
+
+awaitable<void> ClientSession::server_listener() {
+    BufferedReader read_TCP(server_socket);
+    /* turns applied without sending Game, at most max_turn_lag of them */
+    uint16_t turns_unsent = 0;
+
+    for (;;) {
+        /* decode straight from the buffer once the whole message is there,
+           a Turn is only viewed in place, so it is released after handling */
+        ServerMessageView server_message;
+        optional<size_t> decoded_size;
+        size_t needed_size = 0;
+        while (!(decoded_size = try_decode(server_message, read_TCP.data(), needed_size))) {
+            /* buffered turns are all applied, show the last one before waiting */
+            if (turns_unsent > 0) {
+                co_await flush_game_snapshot(turns_unsent);
+            }
+            co_await read_TCP.fill(needed_size);
+        }
+        if (turns_unsent > 0 && !holds_alternative<TurnView>(server_message)) {
+            co_await flush_game_snapshot(turns_unsent);
+        }
+
+        /* the state is sent to gui once the message is handled */
+        bool send_lobby = false;
+        bool send_game = false;
+        bool turn_played = false;
         visit(overloaded {
-            [&](Hello message) {
+            [&](Hello &message) {
                 if (!client.in_lobby && !client.in_game) {
-                    settings = message;
+                    settings = std::move(message);
                     setup();
-                    client_message = lobby;
-                    send_message = true;
+                    send_lobby = true;
                     client.in_lobby = true;
                 }
             },
-            [&](AcceptedPlayer message) {
+            [&](AcceptedPlayer &message) {
                 if (client.in_lobby) {
                     accept_player(message);
-                    client_message = lobby;
-                    send_message = true;
+                    send_lobby = true;
                 }
             },
-            [&](GameStarted message) {
+            [&](GameStarted &message) {
                 if (!client.in_game) {
                     for (auto &[id, player] : message.players) {
-                        AcceptedPlayer new_player = {id, player};
+                        AcceptedPlayer new_player = {id, std::move(player)};
                         accept_player(new_player);
                     }
                     client.in_lobby = false;
                     client.in_game = true;
                 }
             },
-            [&](Turn message) {
+            [&](TurnView const &message) {
                 if (client.in_game) {
-                    vector<BombExploded> turn_bombs_exploded = { };
+                    if (coalesce_input) {
+                        note_turn_arrival(read_TCP.size() > *decoded_size);
+                    }
+                    if (command_sent) {
+                        latency.add(steady_clock::now() - *command_sent);
+                        command_sent.reset();
+                    }
+                    vector<BombExplodedView> turn_bombs_exploded = { };
                     vector<BlockPlaced> turn_blocks_placed = { };
 
-                    update_client_bomb_timers();
+                    /* timers of all bombs change */
+                    if (game.bombs.size() > 0) {
+                        game_encoder.mark_dirty(GameSection::BOMBS);
+                    }
+                    game.bombs.advance();
 
-                    for (Event const &event : message.events) {
+                    for (EventView const &event : message.events) {
                         visit(overloaded {
                             [&](BombPlaced placed) {
-                                client.bombs[placed.id] = 
-                                    (Bomb) { placed.position, settings.bomb_timer };
+                                game.bombs.place(placed.id, placed.position);
+                                game_encoder.mark_dirty(GameSection::BOMBS);
                             },
-                            [&](BombExploded exploded) {
+                            [&](BombExplodedView const &exploded) {
                                 turn_bombs_exploded.push_back(exploded);
                             },
                             [&](PlayerMoved player) {
                                 game.player_positions[player.id] = player.position;
+                                game_encoder.mark_dirty(GameSection::PLAYER_POSITIONS);
                             },
                             [&](BlockPlaced block) {
                                 turn_blocks_placed.push_back(block);
@@ -364,26 +1149,64 @@ awaitable<void> server_listener(
 
                     update_bombs_explosions_blocks(turn_bombs_exploded, turn_blocks_placed,
                         message.turn);
-   
-                    client_message = game;
-                    send_message = true;
+                    turn_played = true;
+
+                    /* with more data buffered the snapshot waits for the next turns */
+                    if (turns_unsent > 0) {
+                        client.snapshots_suppressed++;
+                    }
+                    if (turns_unsent < max_turn_lag) {
+                        turns_unsent++;
+                    }
+                    else {
+                        turns_unsent = 0;
+                        send_game = true;
+                    }
                 }
             },
-            [&](GameEnded) {
+            [&](GameEnded const &) {
                 if (client.in_game) {
+                    if (max_turn_lag > 0) {
+                        cerr << "game ended, " << client.snapshots_suppressed
+                             << " Game snapshots suppressed by turn coalescing\n";
+                        client.snapshots_suppressed = 0;
+                    }
+                    if (!gui_link) {
+                        report_latency();
+                    }
                     setup();
-                    client_message = lobby;
-                    send_message = true;
+                    send_lobby = true;
                     client.in_lobby = true;
                     client.in_game = false;
                     client.join_request_sent = false; // to allow client to join again
                 }
             }
         }, server_message);
+        read_TCP.consume(*decoded_size);
 
-        if (send_message) {
-            serialize(client_message, send_streambuf);
-            co_await gui_socket.async_send_to(send_streambuf.data(), gui_endpoint, use_awaitable);
+        if (gui_link) {
+            if (send_lobby && encode_gui_message(lobby, gui_link->datagram)) {
+                boost::asio::const_buffer buffer = gui_link->datagram.data();
+                co_await send_to_gui({&buffer, 1});
+            }
+            if (send_game && encode_game_message()) {
+                array<boost::asio::const_buffer, GameEncoder::SECTIONS> buffers = 
+                    game_encoder.buffers();
+                co_await send_to_gui(buffers);
+            }
+        }
+        else if (client.in_lobby && !client.join_request_sent) {
+            /* headless sessions join as soon as they are in the lobby */
+            ClientMessageServer join = Join { .name = name };
+            co_await send_to_server(join);
+            client.join_request_sent = true;
+        }
+        else if (turn_played && own_id) {
+            /* sessions left observing, when the game started without them,
+               neither play nor sample latency */
+            ClientMessageServer command = bot_command();
+            co_await send_to_server(command);
+            command_sent = steady_clock::now();
         }
     }
 
@@ -404,38 +1227,96 @@ int main(int argc, char *argv[]) {
     }
 
     try {
-        boost::asio::io_context io_context;
-        
-        /* Prepare socket for receiving data from gui */
-        udp::socket client_socket(io_context);
-        client_socket.open(boost::asio::ip::udp::v6());
-        client_socket.bind({boost::asio::ip::udp::v6(), program_params["port"].as<uint16_t>()});
-
-        /* Prepare socket & endpoint for sending data to gui */
-        udp::resolver gui_resolver(io_context);
-        udp::endpoint gui_endpoint = *gui_resolver.resolve(gui.addr, gui.port).begin();
-        udp::socket gui_socket(io_context);
-        gui_socket.open(gui_endpoint.protocol());
-
-        /* Prepare socket for exchanging data with server */
+        boost::asio::io_context io_context((int) threads_count);
+
+        /* Prepare endpoints of the server and of the gui */
         tcp::resolver server_resolver(io_context);
         tcp::resolver::results_type server_endpoints =
             server_resolver.resolve(server.addr, server.port);
-        tcp::socket server_socket(io_context);
-        boost::asio::connect(server_socket, server_endpoints);
-        server_socket.set_option(tcp::no_delay(true)); // set the TCP_NODELAY flag
+        vector<udp::endpoint> gui_endpoints;
+        if (!headless) {
+            udp::resolver gui_resolver(io_context);
+            gui_endpoints.push_back(*gui_resolver.resolve(gui.addr, gui.port).begin());
+            for (sockaddrStr const &relay : relays) {
+                gui_endpoints.push_back(*gui_resolver.resolve(relay.addr, relay.port).begin());
+            }
+            /* session i sends to every gui and relay port + i */
+            for (udp::endpoint const &endpoint : gui_endpoints) {
+                if (sessions_count > (size_t) UINT16_MAX + 1 - endpoint.port()) {
+                    throw invalid_argument("gui ports of the sessions above 65535");
+                }
+            }
+        }
+
+        /* Open every session's connection before starting any of them */
+        random_device seed;
+        vector<unique_ptr<ClientSession>> sessions;
+        for (size_t index = 0; index < sessions_count; index++) {
+            string name = sessions_count == 1 
+                ? player_name 
+                : player_name + "-" + to_string(index);
+            sessions.push_back(
+                make_unique<ClientSession>(io_context, index, std::move(name), seed()));
+            sessions.back()->connect(server_endpoints);
+            if (!headless) {
+                vector<udp::endpoint> session_gui_endpoints;
+                for (udp::endpoint const &endpoint : gui_endpoints) {
+                    session_gui_endpoints.emplace_back(endpoint.address(), 
+                        (uint16_t) (endpoint.port() + index));
+                }
+                sessions.back()->open_gui(
+                    (uint16_t) (program_params["port"].as<uint16_t>() + index),
+                    std::move(session_gui_endpoints));
+            }
+        }
 
         boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
         signals.async_wait([&](auto, auto){ io_context.stop(); });
 
-        co_spawn(io_context, gui_listener(server_socket, client_socket), rethrow_exception);
-        co_spawn(
-            io_context, 
-            server_listener(server_socket, gui_socket, gui_endpoint), 
-            rethrow_exception
-        );
+        /* a failed session only ends itself, the io_context is stopped once
+           every session has finished */
+        atomic<size_t> sessions_running = sessions.size();
+        atomic<bool> any_session_failed = false;
+        for (unique_ptr<ClientSession> &session : sessions) {
+            session->start([&](bool failed) {
+                if (failed) {
+                    any_session_failed = true;
+                }
+                if (--sessions_running == 0) {
+                    io_context.stop();
+                }
+            });
+        }
 
-        io_context.run();
+        /* an exception in any thread stops all of them and is rethrown here */
+        exception_ptr failure;
+        mutex failure_mutex;
+        auto run = [&]() {
+            try {
+                io_context.run();
+            }
+            catch (...) {
+                lock_guard lock(failure_mutex);
+                if (!failure) {
+                    failure = current_exception();
+                }
+                io_context.stop();
+            }
+        };
+        vector<thread> threads;
+        for (size_t t = 1; t < threads_count; t++) {
+            threads.emplace_back(run);
+        }
+        run();
+        for (thread &worker : threads) {
+            worker.join();
+        }
+        if (failure) {
+            rethrow_exception(failure);
+        }
+        if (any_session_failed) {
+            return 1;
+        }
     }
     catch (exception &e) {
         cerr << "error: " << e.what() << "\n";
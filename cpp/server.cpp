@@ -0,0 +1,1120 @@
+#include <boost/program_options.hpp>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include "board.hpp"
+
+using namespace std;
+using boost::asio::co_spawn;
+using boost::asio::ip::tcp;
+using boost::asio::redirect_error;
+using boost::asio::steady_timer;
+using chrono::steady_clock;
+
+namespace po = boost::program_options;
+
+#define MAX_CLIENTS 25
+#define HIGH_WATERMARK (1 << 20)
+#define LOW_WATERMARK (1 << 18)
+#define MAX_OBSERVER_LAG 100
+
+/* -------------------------------------------------------------------------
+   Useful templates and structures
+   ------------------------------------------------------------------------- */
+/* helper template for variant::visit */
+template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
+
+enum class Stage {
+    Lobby,
+    Game
+};
+
+/* Last command of a player in the current turn, stored without the variant
+   of ClientMessageServer so that recording it never allocates */
+struct PlayerAction {
+    enum class Kind : uint8_t {
+        None,
+        PlaceBomb,
+        PlaceBlock,
+        Move
+    };
+
+    Kind kind = Kind::None;
+    Direction direction = Direction::Up;
+};
+
+/* Encoded server message, immutable once sent and shared by the write queues
+   of all the connections it is sent to */
+using Frame = shared_ptr<const ByteBuffer>;
+
+/* Frames are encoded into buffers of the pool, which are handed out again
+   once no write queue references them, so the lobby and game messages of
+   every game are encoded into the same few buffers */
+class FramePool {
+public:
+    /* returns an empty buffer of at least capacity bytes */
+    shared_ptr<ByteBuffer> acquire(size_t capacity) {
+        for (shared_ptr<ByteBuffer> &buffer : buffers) {
+            if (buffer.use_count() == 1) {
+                buffer->clear();
+                buffer->reserve(capacity);
+                return buffer;
+            }
+        }
+        buffers.push_back(make_shared<ByteBuffer>());
+        buffers.back()->reserve(capacity);
+        return buffers.back();
+    }
+
+private:
+    vector<shared_ptr<ByteBuffer>> buffers;
+};
+
+/* Append-only log of the encoded Turn frames of one game, in one contiguous
+   mapping reserved up front for the longest possible game. Pages are only
+   committed when first written and appended bytes never move, so write
+   queues reference a turn, or the whole history for a late joiner, in
+   place. */
+class TurnLog {
+public:
+    explicit TurnLog(size_t capacity) : capacity(capacity) {
+        void *mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw system_error(errno, generic_category(), "cannot map turn log");
+        }
+        storage = (std::byte *) mapping;
+    }
+
+    TurnLog(TurnLog const &) = delete;
+    TurnLog &operator=(TurnLog const &) = delete;
+
+    ~TurnLog() {
+        munmap(storage, capacity);
+    }
+
+    std::streamsize sputn(const char *data, std::streamsize size) {
+        memcpy(prepare((size_t) size).data(), data, (size_t) size);
+        commit((size_t) size);
+        return size;
+    }
+
+    boost::asio::mutable_buffer prepare(size_t size) {
+        if (size > capacity - length) {
+            throw std::length_error("turn log full");
+        }
+        return {storage + length, size};
+    }
+
+    void commit(size_t size) {
+        length += size;
+    }
+
+    boost::asio::const_buffer data() const {
+        return {storage, length};
+    }
+
+    std::byte *at(size_t offset) {
+        return storage + offset;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /* only for a log no write queue references any more */
+    void clear() {
+        length = 0;
+    }
+
+private:
+    std::byte *storage;
+    size_t capacity;
+    size_t length = 0;
+};
+
+/* Encoded bytes queued for a connection with the buffer owning them, which
+   the queue keeps alive until they are written */
+struct Outgoing {
+    shared_ptr<const void> owner;
+    boost::asio::const_buffer bytes;
+    /* 1 for a Turn broadcast live, the history sent on joining counts 0 */
+    size_t turns = 0;
+
+    static Outgoing of(Frame const &frame) {
+        return {frame, frame->data()};
+    }
+};
+
+/* Time spent on one part of every turn */
+struct TurnTiming {
+    size_t samples = 0;
+    steady_clock::duration total = steady_clock::duration::zero();
+    steady_clock::duration max = steady_clock::duration::zero();
+
+    void add(steady_clock::duration duration) {
+        samples++;
+        total += duration;
+        max = std::max(max, duration);
+    }
+};
+
+/* Distribution of how late turns start after their deadlines. Values below
+   SUB_BUCKETS microseconds have a bucket each; above, every power of two is
+   split into SUB_BUCKETS buckets, which keeps percentiles within about 6%
+   of the exact value in a fixed array. */
+class LatenessHistogram {
+public:
+    static constexpr size_t SUB_BUCKETS = 16;
+    static constexpr size_t BUCKETS = SUB_BUCKETS * 61;
+
+    void add(steady_clock::duration lateness) {
+        uint64_t microseconds = (uint64_t) std::max<int64_t>(
+            chrono::duration_cast<chrono::microseconds>(lateness).count(), 0);
+        counts[bucket(microseconds)]++;
+        samples++;
+        max_microseconds = std::max(max_microseconds, microseconds);
+    }
+
+    size_t size() const {
+        return samples;
+    }
+
+    /* upper bound of the bucket holding the given fraction of samples */
+    uint64_t percentile(double fraction) const {
+        size_t rank = (size_t) ceil(fraction * (double) samples);
+        size_t seen = 0;
+        for (size_t index = 0; index < BUCKETS; index++) {
+            seen += counts[index];
+            if (seen >= std::max<size_t>(rank, 1)) {
+                return std::min(upper_bound(index), max_microseconds);
+            }
+        }
+        return max_microseconds;
+    }
+
+    uint64_t max() const {
+        return max_microseconds;
+    }
+
+    /* calls f(lower, upper, count) for every non-empty bucket in order */
+    template <class F>
+    void for_each(F &&f) const {
+        for (size_t index = 0; index < BUCKETS; index++) {
+            if (counts[index] > 0) {
+                f(lower_bound(index), upper_bound(index), counts[index]);
+            }
+        }
+    }
+
+private:
+    static size_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return (size_t) value;
+        }
+        /* the top bit and the next 4 bits select the bucket */
+        size_t shift = (size_t) bit_width(value) - 5;
+        return (shift + 1) * SUB_BUCKETS + (size_t) ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t lower_bound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        size_t shift = index / SUB_BUCKETS - 1;
+        return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    }
+
+    static uint64_t upper_bound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        return lower_bound(index) + ((uint64_t) 1 << (index / SUB_BUCKETS - 1)) - 1;
+    }
+
+    array<size_t, BUCKETS> counts = { };
+    size_t samples = 0;
+    uint64_t max_microseconds = 0;
+};
+
+/* Deadlines of the turns of a game are anchored to its start, turn k is due
+   at epoch + k * period, so neither the time spent playing a turn nor a late
+   wake-up shifts the turns after it. After a stall the overdue turns are
+   played one after another, each as soon as the loop gets to it, until the
+   schedule is met again; no turn is skipped or played early. Waiting is done
+   on a timerfd armed with TFD_TIMER_ABSTIME when opened with one, steady_clock
+   being CLOCK_MONOTONIC, and on an asio timer otherwise. */
+class TurnScheduler {
+public:
+    explicit TurnScheduler(boost::asio::io_context &io_context)
+        : timer(io_context),
+          timerfd(io_context) {}
+
+    void open(bool use_timerfd) {
+        if (use_timerfd) {
+            int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (fd < 0) {
+                throw system_error(errno, generic_category(), "cannot create timerfd");
+            }
+            timerfd.assign(fd);
+        }
+    }
+
+    void start(steady_clock::time_point epoch, steady_clock::duration period) {
+        this->epoch = epoch;
+        this->period = period;
+    }
+
+    steady_clock::time_point deadline(uint16_t turn) const {
+        return epoch + turn * period;
+    }
+
+    awaitable<void> wait_until(steady_clock::time_point deadline) {
+        if (!timerfd.is_open()) {
+            timer.expires_at(deadline);
+            co_await timer.async_wait(use_awaitable);
+            co_return;
+        }
+
+        auto since_epoch = deadline.time_since_epoch();
+        auto seconds = chrono::duration_cast<chrono::seconds>(since_epoch);
+        itimerspec expiry = { };
+        expiry.it_value.tv_sec = (time_t) seconds.count();
+        expiry.it_value.tv_nsec = (long) chrono::duration_cast<chrono::nanoseconds>(
+            since_epoch - seconds).count();
+        if (timerfd_settime(timerfd.native_handle(), TFD_TIMER_ABSTIME, &expiry, nullptr) < 0) {
+            throw system_error(errno, generic_category(), "cannot arm timerfd");
+        }
+        for (;;) {
+            co_await timerfd.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                use_awaitable);
+            uint64_t expirations;
+            if (read(timerfd.native_handle(), &expirations, sizeof(expirations)) >= 0) {
+                break;
+            }
+            if (errno != EAGAIN) {
+                throw system_error(errno, generic_category(), "cannot read timerfd");
+            }
+        }
+    }
+
+private:
+    steady_timer timer;
+    boost::asio::posix::stream_descriptor timerfd;
+    steady_clock::time_point epoch;
+    steady_clock::duration period = steady_clock::duration::zero();
+};
+
+/* One client connection, shared by its reader and writer coroutines. Bytes
+   for the client are queued by reference; the writer swaps the queue with
+   the entries being written and sends all of them in one gather write, so
+   both vectors keep their capacity. The queue is bounded: once it holds
+   high_watermark bytes the connection is lagging until it drains below
+   low_watermark, and the turns queued meanwhile extend the slice of the log
+   queued last instead of adding entries. An observer falling more than
+   max_observer_lag turns behind is disconnected, and so is any connection
+   still lagging when its game ends. The client's messages are always read,
+   so a player with a slow downlink keeps playing. */
+struct Connection {
+    explicit Connection(tcp::socket socket)
+        : socket(std::move(socket)),
+          wakeup(this->socket.get_executor()) {}
+
+    tcp::socket socket;
+    string address;
+    optional<PlayerId> player;
+    vector<Outgoing> queued;
+    vector<Outgoing> writing;
+    vector<boost::asio::const_buffer> buffers;
+    /* waited on by the writer while queued is empty, cancelled to wake it */
+    steady_timer wakeup;
+    bool closed = false;
+
+    /* bytes and live turns queued or being written, and their peaks */
+    size_t queued_bytes = 0;
+    size_t queued_turns = 0;
+    size_t peak_bytes = 0;
+    size_t peak_turns = 0;
+    bool lagging = false;
+};
+
+/* -------------------------------------------------------------------------
+   Global variables for less argument passing
+   ------------------------------------------------------------------------- */
+po::variables_map program_params;
+
+Hello settings;
+uint64_t turn_duration_ms;
+uint16_t initial_blocks;
+uint32_t seed;
+uint16_t port;
+size_t max_clients;
+size_t high_watermark;
+size_t low_watermark;
+size_t max_observer_lag;
+bool report_turns;
+bool use_timerfd;
+
+/* -------------------------------------------------------------------------
+   Parsing & helper functions
+   ------------------------------------------------------------------------- */
+bool process_command_line(int argc, char** argv) {
+    uint16_t players_count_u16;
+
+    try {
+        po::options_description desc("Allowed options");
+        desc.add_options()
+            ("bomb-timer,b", po::value<uint16_t>(&settings.bomb_timer)->required(),
+                "turns until a bomb explodes")
+            ("players-count,c", po::value<uint16_t>(&players_count_u16)->required(),
+                "players in a game")
+            ("turn-duration,d", po::value<uint64_t>(&turn_duration_ms)->required(),
+                "turn duration in milliseconds")
+            ("explosion-radius,e", po::value<uint16_t>(&settings.explosion_radius)->required(),
+                "length of the arms of an explosion")
+            ("help,h", "help message")
+            ("initial-blocks,k", po::value<uint16_t>(&initial_blocks)->required(),
+                "blocks placed at the start of a game")
+            ("game-length,l", po::value<uint16_t>(&settings.game_length)->required(),
+                "turns in a game")
+            ("server-name,n", po::value<string>(&settings.server_name)->required(),
+                "server name")
+            ("port,p", po::value<uint16_t>(&port)->required(), "port for comms from clients")
+            ("seed,s", po::value<uint32_t>(&seed), "seed of the random number generator")
+            ("max-clients", po::value<size_t>(&max_clients)->default_value(MAX_CLIENTS),
+                "connections served at once, further ones are closed")
+            ("high-watermark", po::value<size_t>(&high_watermark)->default_value(HIGH_WATERMARK),
+                "queued bytes of a connection at which it is lagging, its turns are then "
+                "queued as one slice of the log and it is dropped if still lagging at the "
+                "end of the game")
+            ("low-watermark", po::value<size_t>(&low_watermark)->default_value(LOW_WATERMARK),
+                "queued bytes of a connection below which it is no longer lagging")
+            ("max-observer-lag",
+                po::value<size_t>(&max_observer_lag)->default_value(MAX_OBSERVER_LAG),
+                "turns queued for an observer at which it is disconnected")
+            ("report-turns", po::bool_switch(&report_turns),
+                "print turn timings and write queue depths after every game")
+            ("timerfd", po::bool_switch(&use_timerfd),
+                "wait for turn deadlines on a timerfd instead of an asio timer")
+            ("size-x,x", po::value<uint16_t>(&settings.size_x)->required(), "board width")
+            ("size-y,y", po::value<uint16_t>(&settings.size_y)->required(), "board height");
+
+        po::store(po::parse_command_line(argc, argv, desc), program_params);
+
+        if (program_params.count("help")) {
+            cout << desc << "\n";
+            return false;
+        }
+
+        po::notify(program_params);
+
+        /* a u8 option would be parsed as a single character */
+        if (players_count_u16 == 0 || players_count_u16 > UINT8_MAX) {
+            throw invalid_argument("--players-count must be between 1 and 255");
+        }
+        settings.players_count = (uint8_t) players_count_u16;
+        if (settings.size_x == 0 || settings.size_y == 0) {
+            throw invalid_argument("--size-x and --size-y must be positive");
+        }
+        if (settings.bomb_timer == 0) {
+            throw invalid_argument("--bomb-timer must be positive");
+        }
+        if (turn_duration_ms > (uint64_t) chrono::milliseconds::max().count() / UINT16_MAX) {
+            throw invalid_argument("--turn-duration too long");
+        }
+        if (low_watermark > high_watermark) {
+            throw invalid_argument("--low-watermark above --high-watermark");
+        }
+        if (settings.server_name.size() > UINT8_MAX) {
+            throw invalid_argument("--server-name longer than 255 bytes");
+        }
+        if (!program_params.count("seed")) {
+            seed = (uint32_t) chrono::system_clock::now().time_since_epoch().count();
+        }
+    }
+    catch(exception &e) {
+        cerr << "error: " << e.what() << "\n";
+        return false;
+    }
+    catch(...) {
+        cerr << "Exception of unknown type!\n";
+        return false;
+    }
+
+    return true;
+}
+
+/* completion handler of coroutines whose failure stops the server */
+void rethrow_on_error(exception_ptr error) {
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+/* -------------------------------------------------------------------------
+   State and coroutines of the game server
+   ------------------------------------------------------------------------- */
+/* The server runs the lobby and the games on one thread, so its state needs
+   no locking. Everything a turn touches is sized when the server starts from
+   the players count and the board size: the turn is encoded once, straight
+   into the turn log whose bytes every connection references, explosions are
+   gathered into reserved scratch vectors and bombs and blocks live in
+   structures that do not allocate once grown. */
+class GameServer {
+public:
+    explicit GameServer(boost::asio::io_context &io_context)
+        : executor(io_context.get_executor()),
+          acceptor(io_context),
+          signals(io_context, SIGUSR1),
+          scheduler(io_context),
+          random(seed) {}
+
+    /* opens the dual-stack listening socket and preallocates game state */
+    void start(uint16_t listen_port) {
+        acceptor.open(tcp::v6());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.set_option(boost::asio::ip::v6_only(false));
+        acceptor.bind({tcp::v6(), listen_port});
+        acceptor.listen();
+
+        prepare_buffers();
+        scheduler.open(use_timerfd);
+        co_spawn(executor, accept_clients(), rethrow_on_error);
+        co_spawn(executor, report_on_signal(), rethrow_on_error);
+    }
+
+private:
+    void prepare_buffers();
+    void enqueue(Connection &connection, Outgoing const &outgoing);
+    void send_to_all(Outgoing const &outgoing);
+    void greet(Connection &connection);
+    void disconnect(shared_ptr<Connection> const &connection);
+    void handle_message(Connection &connection, ClientMessageServer &message);
+    void accept_player(Connection &connection, string name);
+    void set_action(Connection &connection, PlayerAction action);
+    void start_game();
+    void end_game();
+    void report_game();
+    void report_lateness();
+    Position random_position();
+    void begin_turn();
+    template <class T>
+    void add_event(T const &event);
+    void finish_turn();
+    void send_turn();
+    void drop_lagging_observers();
+    void drop_lagging_connections();
+    void play_first_turn();
+    void play_turn();
+    void explode_bombs();
+    void act(PlayerId id);
+
+    awaitable<void> accept_clients();
+    awaitable<void> read_client(shared_ptr<Connection> connection);
+    awaitable<void> write_client(shared_ptr<Connection> connection);
+    awaitable<void> run_game();
+    awaitable<void> report_on_signal();
+
+    boost::asio::io_context::executor_type executor;
+    tcp::acceptor acceptor;
+    boost::asio::signal_set signals;
+    TurnScheduler scheduler;
+    LatenessHistogram lateness;
+    minstd_rand random;
+    vector<shared_ptr<Connection>> connections;
+    Stage stage = Stage::Lobby;
+
+    /* frames sent to clients connecting later */
+    FramePool frames;
+    Frame hello_frame;
+    vector<Frame> lobby_frames;
+    Frame game_started_frame;
+    shared_ptr<TurnLog> history;
+    size_t history_capacity = 0;
+
+    /* game state */
+    PlayerTable<Player> players;
+    uint16_t turn = 0;
+    PlayerTable<Position> positions;
+    PlayerTable<Score> scores;
+    Board board;
+    BombTracker bombs;
+    BombId next_bomb_id = 0;
+    array<PlayerAction, PlayerTable<Player>::CAPACITY> actions;
+
+    /* per-turn scratch, reserved by prepare_buffers */
+    size_t turn_start = 0;
+    uint32_t turn_events = 0;
+    vector<pair<BombId, Position>> due_bombs;
+    BombExploded exploded;
+    vector<Position> blocks_destroyed;
+    array<bool, PlayerTable<Player>::CAPACITY> destroyed;
+    TurnTiming play_timing;
+    TurnTiming send_timing;
+    size_t observers_dropped = 0;
+    size_t connections_dropped = 0;
+};
+
+void GameServer::prepare_buffers() {
+    size_t players_count = settings.players_count;
+
+    shared_ptr<ByteBuffer> hello = make_shared<ByteBuffer>();
+    serialize_as<ServerMessageClient>(settings, *hello);
+    hello_frame = hello;
+
+    /* a player places at most one bomb per turn, so at most players_count
+       bombs explode in a turn, each destroying at most 4 blocks */
+    due_bombs.reserve(players_count);
+    exploded.robots_destroyed.reserve(players_count);
+    exploded.blocks_destroyed.reserve(4);
+    blocks_destroyed.reserve(4 * players_count);
+
+    size_t header = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t);
+    size_t bomb_exploded = sizeof(uint8_t) + sizeof(BombId)
+        + sizeof(uint32_t) + players_count * sizeof(PlayerId)
+        + sizeof(uint32_t) + 4 * fixed_wire_size_v<Position>;
+    size_t player_event = sizeof(uint8_t) + fixed_wire_size_v<BombPlaced>;
+    size_t first_turn = header
+        + players_count * (sizeof(uint8_t) + fixed_wire_size_v<PlayerMoved>)
+        + initial_blocks * (sizeof(uint8_t) + fixed_wire_size_v<BlockPlaced>);
+    size_t any_turn = header + players_count * (bomb_exploded + player_event);
+    history_capacity = first_turn + settings.game_length * any_turn;
+
+    lobby_frames.reserve(players_count);
+    connections.reserve(max_clients);
+}
+
+/* -------------------------------------------------------------------------
+   Connections
+   ------------------------------------------------------------------------- */
+/* queues a reference to the bytes and wakes the connection's writer; for a
+   lagging connection, bytes following the slice queued last in the same
+   buffer extend that slice, so the queue does not grow with every turn */
+void GameServer::enqueue(Connection &connection, Outgoing const &outgoing) {
+    if (connection.closed) {
+        return;
+    }
+    Outgoing *last = connection.queued.empty() ? nullptr : &connection.queued.back();
+    bool contiguous = last && last->owner == outgoing.owner
+        && (const std::byte *) last->bytes.data() + last->bytes.size() == outgoing.bytes.data();
+    if (connection.lagging && contiguous) {
+        last->bytes = {last->bytes.data(), last->bytes.size() + outgoing.bytes.size()};
+        last->turns += outgoing.turns;
+    }
+    else {
+        connection.queued.push_back(outgoing);
+    }
+    connection.queued_bytes += outgoing.bytes.size();
+    connection.queued_turns += outgoing.turns;
+    connection.peak_bytes = max(connection.peak_bytes, connection.queued_bytes);
+    connection.peak_turns = max(connection.peak_turns, connection.queued_turns);
+    if (connection.queued_bytes >= high_watermark) {
+        connection.lagging = true;
+    }
+    connection.wakeup.cancel();
+}
+
+/* the bytes are encoded once, whatever the number of connections */
+void GameServer::send_to_all(Outgoing const &outgoing) {
+    for (shared_ptr<Connection> const &connection : connections) {
+        enqueue(*connection, outgoing);
+    }
+}
+
+/* sends Hello, then the lobby's players or the game so far */
+void GameServer::greet(Connection &connection) {
+    enqueue(connection, Outgoing::of(hello_frame));
+    if (stage == Stage::Lobby) {
+        for (Frame const &frame : lobby_frames) {
+            enqueue(connection, Outgoing::of(frame));
+        }
+    }
+    else {
+        /* all turns so far are one slice of the log, written in the same
+           gather write as Hello and GameStarted */
+        enqueue(connection, Outgoing::of(game_started_frame));
+        enqueue(connection, {history, history->data()});
+    }
+}
+
+/* a player disconnecting stays a player, its robot just stops acting */
+void GameServer::disconnect(shared_ptr<Connection> const &connection) {
+    if (connection->closed) {
+        return;
+    }
+    connection->closed = true;
+    boost::system::error_code ignored;
+    connection->socket.shutdown(tcp::socket::shutdown_both, ignored);
+    connection->socket.close(ignored);
+    connection->wakeup.cancel();
+    erase(connections, connection);
+}
+
+void GameServer::handle_message(Connection &connection, ClientMessageServer &message) {
+    visit(overloaded {
+        [&](Join &join) {
+            if (stage == Stage::Lobby && !connection.player) {
+                accept_player(connection, std::move(join.name));
+            }
+        },
+        [&](PlaceBomb) {
+            set_action(connection, {PlayerAction::Kind::PlaceBomb});
+        },
+        [&](PlaceBlock) {
+            set_action(connection, {PlayerAction::Kind::PlaceBlock});
+        },
+        [&](Move move) {
+            if (move.direction > Direction::Left) {
+                throw invalid_argument("unknown direction");
+            }
+            set_action(connection, {PlayerAction::Kind::Move, move.direction});
+        },
+    }, message);
+}
+
+void GameServer::accept_player(Connection &connection, string name) {
+    PlayerId id = (PlayerId) players.size();
+    players[id] = {std::move(name), connection.address};
+    connection.player = id;
+
+    shared_ptr<ByteBuffer> frame = frames.acquire(0);
+    serialize_as<ServerMessageClient>(AcceptedPlayer {id, players[id]}, *frame);
+    lobby_frames.push_back(frame);
+    send_to_all(Outgoing::of(lobby_frames.back()));
+
+    if (players.size() == settings.players_count) {
+        start_game();
+    }
+}
+
+/* only the last command of a turn counts */
+void GameServer::set_action(Connection &connection, PlayerAction action) {
+    if (stage == Stage::Game && connection.player) {
+        actions[*connection.player] = action;
+    }
+}
+
+/* -------------------------------------------------------------------------
+   Game
+   ------------------------------------------------------------------------- */
+void GameServer::start_game() {
+    stage = Stage::Game;
+    shared_ptr<ByteBuffer> frame = frames.acquire(0);
+    uint8_t code = (uint8_t) variant_index_v<ServerMessageClient, GameStarted>;
+    serialize(code, *frame);
+    serialize(players, *frame);
+    game_started_frame = frame;
+    send_to_all(Outgoing::of(game_started_frame));
+    lobby_frames.clear();
+
+    turn = 0;
+    positions.clear();
+    scores.clear();
+    board.reset(settings.size_x, settings.size_y);
+    bombs.reset(settings.bomb_timer);
+    next_bomb_id = 0;
+    actions.fill({ });
+    /* a log still referenced by a slow connection is left to it */
+    if (history && history.use_count() == 1) {
+        history->clear();
+    }
+    else {
+        history = make_shared<TurnLog>(history_capacity);
+    }
+
+    scheduler.start(steady_clock::now(), chrono::milliseconds(turn_duration_ms));
+    play_first_turn();
+    send_turn();
+    co_spawn(executor, run_game(), rethrow_on_error);
+}
+
+void GameServer::end_game() {
+    shared_ptr<ByteBuffer> frame = frames.acquire(0);
+    uint8_t code = (uint8_t) variant_index_v<ServerMessageClient, GameEnded>;
+    serialize(code, *frame);
+    serialize(scores, *frame);
+    send_to_all(Outgoing::of(frame));
+    drop_lagging_connections();
+    if (report_turns) {
+        report_game();
+    }
+
+    stage = Stage::Lobby;
+    players.clear();
+    game_started_frame.reset();
+    for (shared_ptr<Connection> const &connection : connections) {
+        connection->player.reset();
+    }
+}
+
+void GameServer::report_game() {
+    auto microseconds = [](steady_clock::duration duration) {
+        return chrono::duration_cast<chrono::microseconds>(duration).count();
+    };
+    auto average = [&](TurnTiming const &timing) {
+        return timing.samples > 0 ? microseconds(timing.total) / (long) timing.samples : 0;
+    };
+    cout << "game ended: " << play_timing.samples << " turns to " << connections.size()
+         << " connections, turn play avg " << average(play_timing) << " us, max "
+         << microseconds(play_timing.max) << " us, send avg " << average(send_timing)
+         << " us, max " << microseconds(send_timing.max) << " us\n" << flush;
+    play_timing = { };
+    send_timing = { };
+
+    for (shared_ptr<Connection> const &connection : connections) {
+        cout << "  " << connection->address << (connection->player ? " player" : " observer")
+             << ": write queue peak " << connection->peak_turns << " turns, "
+             << connection->peak_bytes << " bytes, now " << connection->queued_turns 
+             << " turns\n";
+        connection->peak_turns = connection->queued_turns;
+        connection->peak_bytes = connection->queued_bytes;
+    }
+    cout << "  " << observers_dropped << " observers dropped as lagging, "
+         << connections_dropped << " connections still lagging at the end\n" << flush;
+    observers_dropped = 0;
+    connections_dropped = 0;
+}
+
+/* lateness of all turns played since the server started */
+void GameServer::report_lateness() {
+    cout << "turn lateness over " << lateness.size() << " turns: p50 "
+         << lateness.percentile(0.5) << " us, p99 " << lateness.percentile(0.99)
+         << " us, max " << lateness.max() << " us\n";
+    lateness.for_each([](uint64_t lower, uint64_t upper, size_t count) {
+        cout << "  " << lower << " - " << upper << " us: " << count << "\n";
+    });
+    cout << flush;
+}
+
+Position GameServer::random_position() {
+    uint16_t x = (uint16_t) (random() % settings.size_x);
+    uint16_t y = (uint16_t) (random() % settings.size_y);
+    return {x, y};
+}
+
+/* starts the Turn frame, its event count is written by finish_turn */
+void GameServer::begin_turn() {
+    turn_start = history->size();
+    uint8_t code = (uint8_t) variant_index_v<ServerMessageClient, Turn>;
+    serialize(code, *history);
+    serialize(turn, *history);
+    serialize(uint32_t { 0 }, *history);
+    turn_events = 0;
+}
+
+template <class T>
+void GameServer::add_event(T const &event) {
+    serialize_as<Event>(event, *history);
+    turn_events++;
+}
+
+void GameServer::finish_turn() {
+    uint32_t events = htonl(turn_events);
+    memcpy(history->at(turn_start + sizeof(uint8_t) + sizeof(uint16_t)), &events,
+        sizeof(events));
+}
+
+void GameServer::send_turn() {
+    send_to_all({history, history->data() + turn_start, 1});
+    drop_lagging_observers();
+}
+
+/* an observer too slow to read the turns only loses its own connection,
+   players keep theirs as the queued turns are only references to the log */
+void GameServer::drop_lagging_observers() {
+    for (size_t i = connections.size(); i-- > 0;) {
+        if (!connections[i]->player && connections[i]->queued_turns > max_observer_lag) {
+            shared_ptr<Connection> lagging = connections[i];
+            cerr << "error: observer " << lagging->address << " is "
+                 << lagging->queued_turns << " turns behind, DISCONNECTED\n";
+            disconnect(lagging);
+            observers_dropped++;
+        }
+    }
+}
+
+/* a connection still lagging when its game ends would keep the log of the
+   game alive through the next one; no game is played at that moment, so
+   dropping it does not change the outcome of one */
+void GameServer::drop_lagging_connections() {
+    for (size_t i = connections.size(); i-- > 0;) {
+        if (connections[i]->lagging) {
+            shared_ptr<Connection> lagging = connections[i];
+            cerr << "error: " << lagging->address << " is " << lagging->queued_bytes
+                 << " bytes behind at the end of the game, DISCONNECTED\n";
+            disconnect(lagging);
+            connections_dropped++;
+        }
+    }
+}
+
+void GameServer::play_first_turn() {
+    begin_turn();
+    players.for_each([this](PlayerId id, Player const &) {
+        Position position = random_position();
+        positions[id] = position;
+        scores[id] = 0;
+        add_event(PlayerMoved {id, position});
+    });
+    for (uint16_t i = 0; i < initial_blocks; i++) {
+        Position position = random_position();
+        board.insert(position);
+        add_event(BlockPlaced {position});
+    }
+    finish_turn();
+}
+
+void GameServer::play_turn() {
+    begin_turn();
+    explode_bombs();
+
+    players.for_each([this](PlayerId id, Player const &) {
+        if (destroyed[id]) {
+            Position position = random_position();
+            positions[id] = position;
+            scores[id]++;
+            add_event(PlayerMoved {id, position});
+        }
+        else {
+            act(id);
+        }
+    });
+    actions.fill({ });
+
+    finish_turn();
+}
+
+/* Explosions of one turn are computed against the board before any of them,
+   so their effects are the union of the single explosions */
+void GameServer::explode_bombs() {
+    bombs.advance();
+    due_bombs.clear();
+    bombs.for_each_due([this](BombId id, Bomb const &bomb) {
+        due_bombs.push_back({id, bomb.position});
+    });
+
+    destroyed.fill(false);
+    blocks_destroyed.clear();
+    for (auto [id, position] : due_bombs) {
+        ExplosionCross cross = board.explosion(position, settings.explosion_radius);
+        exploded.id = id;
+        exploded.robots_destroyed.clear();
+        exploded.blocks_destroyed.clear();
+
+        positions.for_each([&](PlayerId player, Position robot) {
+            if (cross.contains(robot)) {
+                exploded.robots_destroyed.push_back(player);
+                destroyed[player] = true;
+            }
+        });
+
+        /* an arm stops on the first block and destroys it, a bomb on a
+           block destroys only that one */
+        if (board.contains(cross.center)) {
+            exploded.blocks_destroyed.push_back(cross.center);
+        }
+        else {
+            for (Position end : {
+                    Position {cross.center.x, cross.up},
+                    Position {cross.right, cross.center.y},
+                    Position {cross.center.x, cross.down},
+                    Position {cross.left, cross.center.y}}) {
+                if (board.contains(end)) {
+                    exploded.blocks_destroyed.push_back(end);
+                }
+            }
+        }
+        blocks_destroyed.insert(blocks_destroyed.end(),
+            exploded.blocks_destroyed.begin(), exploded.blocks_destroyed.end());
+
+        add_event(exploded);
+        bombs.explode(id);
+    }
+
+    for (Position block : blocks_destroyed) {
+        board.erase(block);
+    }
+}
+
+/* applies the player's last command, ignoring moves off the board or onto
+   a block and blocks on an already blocked cell */
+void GameServer::act(PlayerId id) {
+    PlayerAction action = actions[id];
+    Position &position = positions[id];
+    switch (action.kind) {
+        case PlayerAction::Kind::None:
+            break;
+        case PlayerAction::Kind::PlaceBomb: {
+            BombId bomb_id = next_bomb_id++;
+            bombs.place(bomb_id, position);
+            add_event(BombPlaced {bomb_id, position});
+            break;
+        }
+        case PlayerAction::Kind::PlaceBlock:
+            if (board.insert(position)) {
+                add_event(BlockPlaced {position});
+            }
+            break;
+        case PlayerAction::Kind::Move: {
+            Position next = position;
+            switch (action.direction) {
+                case Direction::Up:
+                    next.y++;
+                    break;
+                case Direction::Right:
+                    next.x++;
+                    break;
+                case Direction::Down:
+                    next.y--;
+                    break;
+                case Direction::Left:
+                    next.x--;
+                    break;
+            }
+            if (board.on_board(next) && !board.contains(next)) {
+                position = next;
+                add_event(PlayerMoved {id, position});
+            }
+            break;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------
+   Coroutine functions
+   ------------------------------------------------------------------------- */
+awaitable<void> GameServer::accept_clients() {
+    for (;;) {
+        tcp::socket socket = co_await acceptor.async_accept(use_awaitable);
+        if (connections.size() >= max_clients) {
+            continue;
+        }
+
+        boost::system::error_code error;
+        tcp::endpoint peer = socket.remote_endpoint(error);
+        if (error) {
+            continue;
+        }
+        socket.set_option(tcp::no_delay(true)); // set the TCP_NODELAY flag
+
+        shared_ptr<Connection> connection = make_shared<Connection>(std::move(socket));
+        connection->address = address_str(peer);
+        connections.push_back(connection);
+        greet(*connection);
+
+        /* whichever coroutine ends first closes the connection for both */
+        auto close = [this, connection](exception_ptr) { disconnect(connection); };
+        co_spawn(executor, read_client(connection), close);
+        co_spawn(executor, write_client(connection), close);
+    }
+}
+
+awaitable<void> GameServer::read_client(shared_ptr<Connection> connection) {
+    BufferedReader read_TCP(connection->socket);
+
+    try {
+        for (;;) {
+            ClientMessageServer message;
+            optional<size_t> decoded_size;
+            size_t needed_size = 0;
+            while (!(decoded_size = try_decode(message, read_TCP.data(), needed_size))) {
+                co_await read_TCP.fill(needed_size);
+            }
+            read_TCP.consume(*decoded_size);
+            handle_message(*connection, message);
+        }
+    }
+    catch (invalid_argument &e) {
+        cerr << "error: " << e.what() << " from " << connection->address
+             << ", DISCONNECTED\n";
+    }
+}
+
+awaitable<void> GameServer::write_client(shared_ptr<Connection> connection) {
+    while (!connection->closed) {
+        if (connection->queued.empty()) {
+            boost::system::error_code ignored;
+            connection->wakeup.expires_at(steady_timer::time_point::max());
+            co_await connection->wakeup.async_wait(redirect_error(use_awaitable, ignored));
+            continue;
+        }
+        swap(connection->queued, connection->writing);
+        connection->buffers.clear();
+        for (Outgoing const &outgoing : connection->writing) {
+            connection->buffers.push_back(outgoing.bytes);
+        }
+        co_await boost::asio::async_write(connection->socket, connection->buffers,
+            use_awaitable);
+        for (Outgoing const &outgoing : connection->writing) {
+            connection->queued_bytes -= outgoing.bytes.size();
+            connection->queued_turns -= outgoing.turns;
+        }
+        connection->writing.clear();
+        if (connection->lagging && connection->queued_bytes < low_watermark) {
+            connection->lagging = false;
+        }
+    }
+}
+
+awaitable<void> GameServer::run_game() {
+    while (turn < settings.game_length) {
+        steady_clock::time_point deadline = scheduler.deadline((uint16_t) (turn + 1));
+        co_await scheduler.wait_until(deadline);
+        turn++;
+        steady_clock::time_point started = steady_clock::now();
+        lateness.add(started - deadline);
+        play_turn();
+        steady_clock::time_point played = steady_clock::now();
+        send_turn();
+        play_timing.add(played - started);
+        send_timing.add(steady_clock::now() - played);
+    }
+    end_game();
+}
+
+awaitable<void> GameServer::report_on_signal() {
+    for (;;) {
+        co_await signals.async_wait(use_awaitable);
+        report_lateness();
+    }
+}
+
+/* -------------------------------------------------------------------------
+   Main function for parsing, opening the socket and starting coroutines
+   ------------------------------------------------------------------------- */
+int main(int argc, char *argv[]) {
+
+    /* Parse command line parameters */
+    bool parsing_result = process_command_line(argc, argv);
+
+    if (!parsing_result) {
+        cerr << "Failed to parse parameters\n";
+        return 1;
+    }
+
+    try {
+        boost::asio::io_context io_context(1);
+
+        GameServer server(io_context);
+        server.start(port);
+
+        boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+        signals.async_wait([&](auto, auto){ io_context.stop(); });
+
+        io_context.run();
+    }
+    catch (exception &e) {
+        cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+    catch(...) {
+        cerr << "Exception of unknown type!\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,8 +1,14 @@
+#pragma once
+
 #include <boost/asio.hpp>
 #include "include/boost/pfr/core.hpp"
 
 #include <stdio.h>
+#include <array>
 #include <concepts>
+#include <cstring>
+#include <optional>
+#include <span>
 #include <variant>
 
 using boost::asio::awaitable;
@@ -20,7 +26,6 @@ using boost::asio::use_awaitable;
 enum class Direction : uint8_t;
 
 struct Position;
-struct SignedPosition;
 struct Bomb;
 struct Player;
 
@@ -42,16 +47,6 @@ struct Position {
     auto operator<=>(const Position &) const = default;
 };
 
-struct SignedPosition {
-    int32_t x;
-    int32_t y;
-    SignedPosition& operator+=(const SignedPosition &other) {
-        this->x += other.x;
-        this->y += other.y;
-        return *this;
-    };
-};
-
 struct Bomb {
     Position position;
     uint16_t timer;
@@ -192,6 +187,19 @@ using ServerMessageClient = std::variant<Hello, AcceptedPlayer, GameStarted, Tur
 using ClientMessageGui = std::variant<Lobby, Game>;
 using GuiMessageClient = std::variant<PlaceBomb, PlaceBlock, Move>;
 
+/* address of a client as sent in Player, IPv4 clients of a dual-stack
+   socket are shown without the IPv4-mapped prefix */
+inline std::string address_str(boost::asio::ip::tcp::endpoint const &endpoint) {
+    boost::asio::ip::address address = endpoint.address();
+    if (address.is_v6() && address.to_v6().is_v4_mapped()) {
+        address = boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+    }
+    if (address.is_v6()) {
+        return "[" + address.to_string() + "]:" + std::to_string(endpoint.port());
+    }
+    return address.to_string() + ":" + std::to_string(endpoint.port());
+}
+
 /* -------------------------------------------------------------------------
    Concepts for template serializing and deserializing functions
    ------------------------------------------------------------------------- */
@@ -201,45 +209,266 @@ template <class T>
 concept Enum = std::is_enum_v<T>;
 template <class T>
 concept Unsigned = std::is_unsigned_v<T>;
+/* boost::asio::streambuf, FixedBuffer and ByteBuffer all qualify as a sink */
+template <class S>
+concept ByteSink = requires(S &sb, const char *data, size_t size) {
+    sb.sputn(data, (std::streamsize) size);
+    { sb.prepare(size) } -> std::convertible_to<boost::asio::mutable_buffer>;
+    sb.commit(size);
+};
+
+/* -------------------------------------------------------------------------
+   Fixed-capacity sink for serializing into caller-provided storage
+   ------------------------------------------------------------------------- */
+/* Encodes into a fixed std::array instead of a growing heap buffer, for
+   messages with a known size bound such as UDP datagrams. Overflowing the
+   array throws std::length_error. */
+template <size_t N>
+class FixedBuffer {
+public:
+    explicit FixedBuffer(std::array<std::byte, N> &storage) : storage(storage) {}
+
+    std::streamsize sputn(const char *data, std::streamsize size) {
+        memcpy(prepare((size_t) size).data(), data, (size_t) size);
+        commit((size_t) size);
+        return size;
+    }
+
+    boost::asio::mutable_buffer prepare(size_t size) {
+        if (size > N - length) {
+            throw std::length_error("message above fixed buffer capacity");
+        }
+        return {storage.data() + length, size};
+    }
+
+    void commit(size_t size) {
+        length += size;
+    }
+
+    boost::asio::const_buffer data() const {
+        return {storage.data(), length};
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    void clear() {
+        length = 0;
+    }
+
+private:
+    std::array<std::byte, N> &storage;
+    size_t length = 0;
+};
+
+/* -------------------------------------------------------------------------
+   Growable sink reusing its storage between messages
+   ------------------------------------------------------------------------- */
+/* Encodes into a heap buffer that doubles when full and keeps its capacity
+   when cleared, so a buffer reserved for the largest message is refilled
+   without allocating. Bytes already written can be patched in place, e.g. a
+   List size known only after its elements are written. */
+class ByteBuffer {
+public:
+    void reserve(size_t capacity) {
+        if (capacity > storage.size()) {
+            storage.resize(capacity);
+        }
+    }
+
+    std::streamsize sputn(const char *data, std::streamsize size) {
+        memcpy(prepare((size_t) size).data(), data, (size_t) size);
+        commit((size_t) size);
+        return size;
+    }
+
+    boost::asio::mutable_buffer prepare(size_t size) {
+        if (size > storage.size() - length) {
+            reserve(std::max(2 * storage.size(), length + size));
+        }
+        return {storage.data() + length, size};
+    }
+
+    void commit(size_t size) {
+        length += size;
+    }
+
+    boost::asio::const_buffer data() const {
+        return {storage.data(), length};
+    }
+
+    std::byte *at(size_t offset) {
+        return storage.data() + offset;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    size_t capacity() const {
+        return storage.size();
+    }
+
+    void clear() {
+        length = 0;
+    }
+
+private:
+    std::vector<std::byte> storage;
+    size_t length = 0;
+};
+
+/* -------------------------------------------------------------------------
+   Compile-time wire layout of fixed-size structures
+   ------------------------------------------------------------------------- */
+/* Structures built only from enums, unsigned integers and other such
+   structures always encode to the same number of bytes. Their size is
+   summed over the pfr field list at compile time, which lets them be encoded
+   and decoded with a single bounds check. */
+inline constexpr size_t VARIABLE_WIRE_SIZE = SIZE_MAX;
+
+template <class T>
+constexpr size_t fixed_wire_size() {
+    if constexpr (Enum<T>) {
+        return sizeof(uint8_t);
+    }
+    else if constexpr (Unsigned<T>) {
+        return sizeof(T);
+    }
+    else if constexpr (Aggregate<T>) {
+        return []<size_t... I>(std::index_sequence<I...>) {
+            size_t field_sizes[] = {0, fixed_wire_size<boost::pfr::tuple_element_t<I, T>>()...};
+            size_t total = 0;
+            for (size_t field_size : field_sizes) {
+                if (field_size == VARIABLE_WIRE_SIZE) {
+                    return VARIABLE_WIRE_SIZE;
+                }
+                total += field_size;
+            }
+            return total;
+        }(std::make_index_sequence<boost::pfr::tuple_size_v<T>>{});
+    }
+    else {
+        return VARIABLE_WIRE_SIZE;
+    }
+}
+
+template <class T>
+inline constexpr size_t fixed_wire_size_v = fixed_wire_size<T>();
+
+template <class T>
+concept FixedWire = fixed_wire_size_v<T> != VARIABLE_WIRE_SIZE;
+
+/* Wire layout table of the protocol's fixed-size structures */
+static_assert(fixed_wire_size_v<Direction> == 1);
+static_assert(fixed_wire_size_v<Position> == 4);
+static_assert(fixed_wire_size_v<Bomb> == 6);
+static_assert(fixed_wire_size_v<PlaceBomb> == 0);
+static_assert(fixed_wire_size_v<PlaceBlock> == 0);
+static_assert(fixed_wire_size_v<Move> == 1);
+static_assert(fixed_wire_size_v<BombPlaced> == 8);
+static_assert(fixed_wire_size_v<PlayerMoved> == 5);
+static_assert(fixed_wire_size_v<BlockPlaced> == 4);
+static_assert(!FixedWire<Player> && !FixedWire<BombExploded> && !FixedWire<Turn>);
+
+/* Stores arg at out in network byte order, returns the end of the stored bytes */
+template <FixedWire T>
+std::byte *encode_fixed(T const &arg, std::byte *out) {
+    if constexpr (Enum<T>) {
+        *out = (std::byte) arg;
+        return out + sizeof(uint8_t);
+    }
+    else if constexpr (Unsigned<T>) {
+        T net_arg = arg;
+        if constexpr (sizeof(T) == sizeof(uint16_t)) {
+            net_arg = htons(arg);
+        }
+        if constexpr (sizeof(T) == sizeof(uint32_t)) {
+            net_arg = htonl(arg);
+        }
+        memcpy(out, &net_arg, sizeof(T));
+        return out + sizeof(T);
+    }
+    else {
+        boost::pfr::for_each_field(arg, [&out](auto const &field) {
+            out = encode_fixed(field, out);
+        });
+        return out;
+    }
+}
+
+/* Loads arg from network byte order at in, returns the end of the loaded bytes */
+template <FixedWire T>
+const std::byte *decode_fixed(T &arg, const std::byte *in) {
+    if constexpr (Enum<T>) {
+        arg = (T) *in;
+        return in + sizeof(uint8_t);
+    }
+    else if constexpr (Unsigned<T>) {
+        memcpy(&arg, in, sizeof(T));
+        if constexpr (sizeof(T) == sizeof(uint16_t)) {
+            arg = ntohs(arg);
+        }
+        if constexpr (sizeof(T) == sizeof(uint32_t)) {
+            arg = ntohl(arg);
+        }
+        return in + sizeof(T);
+    }
+    else {
+        boost::pfr::for_each_field(arg, [&in](auto &field) {
+            in = decode_fixed(field, in);
+        });
+        return in;
+    }
+}
 
 /* -------------------------------------------------------------------------
    Template functions for serializing all program structures
    ------------------------------------------------------------------------- */
 /* Declarations */
-template <Aggregate T>
-void serialize(T const &arg, boost::asio::streambuf &sb);
+template <Aggregate T, ByteSink Sink>
+void serialize(T const &arg, Sink &sb);
 
-template <Enum T>
-void serialize(T const &arg, boost::asio::streambuf &sb);
+template <Enum T, ByteSink Sink>
+void serialize(T const &arg, Sink &sb);
 
-template <Unsigned T>
-void serialize(T const &arg, boost::asio::streambuf &sb);
+template <Unsigned T, ByteSink Sink>
+void serialize(T const &arg, Sink &sb);
 
-template <class... Ts>
-void serialize(std::variant<Ts...> const &arg, boost::asio::streambuf &sb);
+template <class... Ts, ByteSink Sink>
+void serialize(std::variant<Ts...> const &arg, Sink &sb);
 
-template <class T>
-void serialize(std::vector<T> const &vec, boost::asio::streambuf &sb);
+template <class T, ByteSink Sink>
+void serialize(std::vector<T> const &vec, Sink &sb);
 
-template <class K, class V>
-void serialize(std::map<K, V> const &map, boost::asio::streambuf &sb);
+template <class K, class V, ByteSink Sink>
+void serialize(std::map<K, V> const &map, Sink &sb);
 
-void serialize(std::string const &arg, boost::asio::streambuf &sb);
+template <ByteSink Sink>
+void serialize(std::string const &arg, Sink &sb);
 
 /* Definitions */
-template <Aggregate T>
-void serialize(T const &arg, boost::asio::streambuf &sb) {
-    boost::pfr::for_each_field(arg, [&sb](auto const &field) { serialize(field, sb); });
+template <Aggregate T, ByteSink Sink>
+void serialize(T const &arg, Sink &sb) {
+    if constexpr (FixedWire<T>) {
+        constexpr size_t size = fixed_wire_size_v<T>;
+        encode_fixed(arg, (std::byte *) sb.prepare(size).data());
+        sb.commit(size);
+    }
+    else {
+        boost::pfr::for_each_field(arg, [&sb](auto const &field) { serialize(field, sb); });
+    }
 }
 
-template <Enum T>
-void serialize(T const &arg, boost::asio::streambuf &sb) {
+template <Enum T, ByteSink Sink>
+void serialize(T const &arg, Sink &sb) {
     uint8_t code = (uint8_t) arg;
     sb.sputn((const char *) &code, sizeof(code));
 }
 
-template <Unsigned T>
-void serialize(T const &arg, boost::asio::streambuf &sb) {
+template <Unsigned T, ByteSink Sink>
+void serialize(T const &arg, Sink &sb) {
     if constexpr (sizeof(T) == sizeof(uint8_t)) {
         uint8_t net_arg = arg;
         sb.sputn((const char *) &net_arg, sizeof(net_arg));
@@ -258,8 +487,8 @@ void serialize(T const &arg, boost::asio::streambuf &sb) {
     throw std::invalid_argument("unknown unsigned type\n");
 }
 
-template <class... Ts>
-void serialize(std::variant<Ts...> const &arg, boost::asio::streambuf &sb) {
+template <class... Ts, ByteSink Sink>
+void serialize(std::variant<Ts...> const &arg, Sink &sb) {
     uint8_t code = (uint8_t) arg.index();
     sb.sputn((const char *) &code, sizeof(code));
     visit([&sb](auto const &a) {
@@ -267,9 +496,20 @@ void serialize(std::variant<Ts...> const &arg, boost::asio::streambuf &sb) {
     }, arg);
 }
 
-template <class T>
-void serialize(std::vector<T> const &vec, boost::asio::streambuf &sb) {
+template <class T, ByteSink Sink>
+void serialize(std::vector<T> const &vec, Sink &sb) {
     uint32_t vec_size = (uint32_t) vec.size();
+    if constexpr (FixedWire<T>) {
+        /* the whole list is reserved once and filled in a single loop */
+        size_t size = sizeof(vec_size) + vec.size() * fixed_wire_size_v<T>;
+        std::byte *out = (std::byte *) sb.prepare(size).data();
+        out = encode_fixed(vec_size, out);
+        for (T const &elem : vec) {
+            out = encode_fixed(elem, out);
+        }
+        sb.commit(size);
+        return;
+    }
     uint32_t net_vec_size = htonl(vec_size);
     sb.sputn((const char *) &net_vec_size, sizeof(net_vec_size));
     for (T const &elem : vec) {
@@ -277,8 +517,8 @@ void serialize(std::vector<T> const &vec, boost::asio::streambuf &sb) {
     }
 }
 
-template <class K, class V>
-void serialize(std::map<K, V> const &map, boost::asio::streambuf &sb) {
+template <class K, class V, ByteSink Sink>
+void serialize(std::map<K, V> const &map, Sink &sb) {
     uint32_t map_size = (uint32_t) map.size();
     uint32_t net_map_size = htonl(map_size);
     sb.sputn((const char *) &net_map_size, sizeof(net_map_size));
@@ -289,7 +529,8 @@ void serialize(std::map<K, V> const &map, boost::asio::streambuf &sb) {
     }
 }
 
-void serialize(std::string const &arg, boost::asio::streambuf &sb) {
+template <ByteSink Sink>
+void serialize(std::string const &arg, Sink &sb) {
     if (arg.size() > UINT8_MAX) {
         throw std::length_error("std::string length above 255");
     }
@@ -298,9 +539,141 @@ void serialize(std::string const &arg, boost::asio::streambuf &sb) {
     sb.sputn((const char *) arg.data(), arg_size);
 }
 
+/* -------------------------------------------------------------------------
+   Template functions for computing serialized sizes of all structures
+   ------------------------------------------------------------------------- */
+/* Every overload returns the exact number of bytes the serialize overload
+   of the same shape writes, so output buffers can be sized once */
+/* Declarations */
+template <Aggregate T>
+size_t serialized_size(T const &arg);
+
+template <Enum T>
+size_t serialized_size(T const &arg);
+
+template <Unsigned T>
+size_t serialized_size(T const &arg);
+
+template <class... Ts>
+size_t serialized_size(std::variant<Ts...> const &arg);
+
+template <class T>
+size_t serialized_size(std::vector<T> const &vec);
+
+template <class K, class V>
+size_t serialized_size(std::map<K, V> const &map);
+
+inline size_t serialized_size(std::string const &arg);
+
+/* Definitions */
+template <Aggregate T>
+size_t serialized_size(T const &arg) {
+    if constexpr (FixedWire<T>) {
+        return fixed_wire_size_v<T>;
+    }
+    else {
+        size_t size = 0;
+        boost::pfr::for_each_field(arg, [&size](auto const &field) {
+            size += serialized_size(field);
+        });
+        return size;
+    }
+}
+
+template <Enum T>
+size_t serialized_size(T const &) {
+    return sizeof(uint8_t);
+}
+
+template <Unsigned T>
+size_t serialized_size(T const &) {
+    return sizeof(T);
+}
+
+template <class... Ts>
+size_t serialized_size(std::variant<Ts...> const &arg) {
+    return sizeof(uint8_t) + visit([](auto const &a) {
+        return serialized_size(a);
+    }, arg);
+}
+
+template <class T>
+size_t serialized_size(std::vector<T> const &vec) {
+    size_t size = sizeof(uint32_t);
+    if constexpr (FixedWire<T>) {
+        return size + vec.size() * fixed_wire_size_v<T>;
+    }
+    for (T const &elem : vec) {
+        size += serialized_size(elem);
+    }
+    return size;
+}
+
+template <class K, class V>
+size_t serialized_size(std::map<K, V> const &map) {
+    size_t size = sizeof(uint32_t);
+    if constexpr (FixedWire<K> && FixedWire<V>) {
+        return size + map.size() * (fixed_wire_size_v<K> + fixed_wire_size_v<V>);
+    }
+    for (auto const &[key, val] : map) {
+        size += serialized_size(key) + serialized_size(val);
+    }
+    return size;
+}
+
+inline size_t serialized_size(std::string const &arg) {
+    return sizeof(uint8_t) + arg.size();
+}
+
+/* -------------------------------------------------------------------------
+   Serializing one alternative of a variant without constructing the variant
+   ------------------------------------------------------------------------- */
+/* Protocol structure whose wire format T has; a type encoding like one of
+   the protocol structures names it with a member alias wire_type */
+template <class T>
+struct wire_type {
+    using type = T;
+};
+
+template <class T>
+requires requires { typename T::wire_type; }
+struct wire_type<T> {
+    using type = typename T::wire_type;
+};
+
+template <class T>
+using wire_type_t = typename wire_type<T>::type;
+
+/* Position of T among the alternatives of Variant, which is its type ID */
+template <class Variant, class T>
+inline constexpr size_t variant_index_v = []<class... Ts>(std::type_identity<std::variant<Ts...>>) {
+    static_assert((std::is_same_v<T, Ts> || ...), "type is not an alternative of the variant");
+    size_t index = 0;
+    ((std::is_same_v<T, Ts> || (index++, false)) || ...);
+    return index;
+}(std::type_identity<Variant>{});
+
+/* Writes arg exactly as serialize would write a Variant holding arg */
+template <class Variant, class T, ByteSink Sink>
+void serialize_as(T const &arg, Sink &sb) {
+    uint8_t code = (uint8_t) variant_index_v<Variant, wire_type_t<T>>;
+    sb.sputn((const char *) &code, sizeof(code));
+    serialize(arg, sb);
+}
+
+template <class Variant, class T>
+size_t serialized_size_as(T const &arg) {
+    static_assert(variant_index_v<Variant, wire_type_t<T>> < std::variant_size_v<Variant>);
+    return sizeof(uint8_t) + serialized_size(arg);
+}
+
 /* -------------------------------------------------------------------------
    Template functions for deserializing all program structures
    ------------------------------------------------------------------------- */
+/* Reads a structure field by field through an awaitable read(arg, size)
+   callback such as BufferedReader, suspending whenever the bytes run out.
+   The read loops decode whole buffered messages with try_decode instead;
+   this is the fallback for a reader that cannot hold a whole message. */
 /* Declarations */
 template <Aggregate T, typename F>
 awaitable<void> deserialize(T &arg, F &read);
@@ -311,6 +684,9 @@ awaitable<void> deserialize(T &arg, F &read);
 template <Unsigned T, typename F>
 awaitable<void> deserialize(T &arg, F &read);
 
+template <size_t I, class Variant, typename F>
+awaitable<void> deserialize_alternative(Variant &arg, F &read);
+
 template <class... Ts, typename F>
 awaitable<void> deserialize(std::variant<Ts...> &arg, F &read);
 
@@ -357,52 +733,28 @@ awaitable<void> deserialize(T &arg, F &read) {
     throw std::invalid_argument("unknown unsigned type\n");
 }
 
+template <size_t I, class Variant, typename F>
+awaitable<void> deserialize_alternative(Variant &arg, F &read) {
+    co_await deserialize(arg.template emplace<I>(), read);
+    co_return;
+}
+
 template <class... Ts, typename F>
 awaitable<void> deserialize(std::variant<Ts...> &arg, F &read) {
+    using Alternative = awaitable<void> (*)(std::variant<Ts...> &, F &);
+    /* jump table indexed by variant type ID, one entry per alternative */
+    static constexpr auto alternatives = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<Alternative, sizeof...(Ts)>{
+            &deserialize_alternative<I, std::variant<Ts...>, F>...
+        };
+    }(std::index_sequence_for<Ts...>{});
+
     uint8_t code;
     co_await deserialize(code, read);
-    if (code >= std::variant_size_v<std::variant<Ts...>>) {
+    if (code >= alternatives.size()) {
         throw std::invalid_argument("unknown variant type ID\n");
     }
-    /* we need as many ifs as there are codes possible, here from 0 to 4 */
-    if (code == 0) { // All variants have defined code 0
-        std::variant_alternative_t<0, std::variant<Ts...>> alt;
-        co_await deserialize(alt, read);
-        arg = alt;
-    }
-    if (code == 1) { // All variants have defined code 1
-        std::variant_alternative_t<1, std::variant<Ts...>> alt;
-        co_await deserialize(alt, read);
-        arg = alt;
-    }
-    if constexpr (std::is_same_v<std::variant<Ts...>, ClientMessageServer> ||
-                 std::is_same_v<std::variant<Ts...>, ServerMessageClient> ||
-                 std::is_same_v<std::variant<Ts...>, GuiMessageClient> ||
-                 std::is_same_v<std::variant<Ts...>, Event>
-    ) {
-        if (code == 2) {
-            std::variant_alternative_t<2, std::variant<Ts...>> alt;
-            co_await deserialize(alt, read);
-            arg = alt;
-        }
-    }
-    if constexpr (std::is_same_v<std::variant<Ts...>, ClientMessageServer> ||
-                 std::is_same_v<std::variant<Ts...>, ServerMessageClient> ||
-                 std::is_same_v<std::variant<Ts...>, Event>
-    ) {
-        if (code == 3) {
-            std::variant_alternative_t<3, std::variant<Ts...>> alt;
-            co_await deserialize(alt, read);
-            arg = alt;
-        }
-    }
-    if constexpr (std::is_same_v<std::variant<Ts...>, ServerMessageClient>) {
-        if (code == 4) {
-            std::variant_alternative_t<4, std::variant<Ts...>> alt;
-            co_await deserialize(alt, read);
-            arg = alt;
-        }
-    }
+    co_await alternatives[code](arg, read);
     co_return;
 }
 
@@ -439,3 +791,435 @@ awaitable<void> deserialize(std::string &arg, F &read) {
     co_await read(arg.data(), size);
     co_return;
 }
+
+
+/* -------------------------------------------------------------------------
+   Template functions for decoding fully buffered structures
+   ------------------------------------------------------------------------- */
+/* Synchronous counterpart of deserialize for data that is already in memory.
+   Every decode overload mirrors the deserialize overload of the same shape,
+   but runs as plain function calls over a span. A decode returning false
+   means the span ended before the structure did; needed is then the length
+   the span must reach before decoding can get any further. */
+struct SpanSource {
+    std::span<const std::byte> bytes;
+    size_t offset = 0;
+    size_t needed = 0;
+
+    bool take(void *arg, size_t size) {
+        if (size > remaining()) {
+            return starve(size);
+        }
+        memcpy(arg, bytes.data() + offset, size);
+        offset += size;
+        return true;
+    }
+
+    size_t remaining() const {
+        return bytes.size() - offset;
+    }
+
+    /* records that size bytes past the offset are missing, returns false */
+    bool starve(size_t size) {
+        needed = offset + size;
+        return false;
+    }
+};
+
+/* Declarations */
+template <Aggregate T>
+bool decode(T &arg, SpanSource &src);
+
+template <Enum T>
+bool decode(T &arg, SpanSource &src);
+
+template <Unsigned T>
+bool decode(T &arg, SpanSource &src);
+
+template <size_t I, class Variant>
+bool decode_alternative(Variant &arg, SpanSource &src);
+
+template <class... Ts>
+bool decode(std::variant<Ts...> &arg, SpanSource &src);
+
+template <class T>
+bool decode(std::vector<T> &vec, SpanSource &src);
+
+template <class K, class V>
+bool decode(std::map<K, V> &map, SpanSource &src);
+
+inline bool decode(std::string &arg, SpanSource &src);
+
+/* Definitions */
+template <Aggregate T>
+bool decode(T &arg, SpanSource &src) {
+    if constexpr (FixedWire<T>) {
+        if (fixed_wire_size_v<T> > src.remaining()) {
+            return src.starve(fixed_wire_size_v<T>);
+        }
+        decode_fixed(arg, src.bytes.data() + src.offset);
+        src.offset += fixed_wire_size_v<T>;
+        return true;
+    }
+    else {
+        return std::apply([&src] (auto &... fields) {
+            return (decode(fields, src) && ...);
+        }, boost::pfr::structure_tie(arg));
+    }
+}
+
+template <Enum T>
+bool decode(T &arg, SpanSource &src) {
+    return src.take(&arg, sizeof(uint8_t));
+}
+
+template <Unsigned T>
+bool decode(T &arg, SpanSource &src) {
+    if constexpr (sizeof(T) == sizeof(uint8_t)) {
+        return src.take(&arg, sizeof(uint8_t));
+    }
+    if constexpr (sizeof(T) == sizeof(uint16_t)) {
+        if (!src.take(&arg, sizeof(uint16_t))) {
+            return false;
+        }
+        arg = ntohs(arg);
+        return true;
+    }
+    if constexpr (sizeof(T) == sizeof(uint32_t)) {
+        if (!src.take(&arg, sizeof(uint32_t))) {
+            return false;
+        }
+        arg = ntohl(arg);
+        return true;
+    }
+    throw std::invalid_argument("unknown unsigned type\n");
+}
+
+template <size_t I, class Variant>
+bool decode_alternative(Variant &arg, SpanSource &src) {
+    return decode(arg.template emplace<I>(), src);
+}
+
+template <class... Ts>
+bool decode(std::variant<Ts...> &arg, SpanSource &src) {
+    using Alternative = bool (*)(std::variant<Ts...> &, SpanSource &);
+    /* jump table indexed by variant type ID, one entry per alternative */
+    static constexpr auto alternatives = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<Alternative, sizeof...(Ts)>{
+            &decode_alternative<I, std::variant<Ts...>>...
+        };
+    }(std::index_sequence_for<Ts...>{});
+
+    uint8_t code;
+    if (!decode(code, src)) {
+        return false;
+    }
+    if (code >= alternatives.size()) {
+        throw std::invalid_argument("unknown variant type ID\n");
+    }
+    return alternatives[code](arg, src);
+}
+
+template <class T>
+bool decode(std::vector<T> &vec, SpanSource &src) {
+    uint32_t size;
+    if (!decode(size, src)) {
+        return false;
+    }
+    /* do not trust the announced size further than the bytes at hand */
+    vec.clear();
+    vec.reserve(std::min((size_t) size, src.remaining()));
+    while (size--) {
+        if (!decode(vec.emplace_back(), src)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class K, class V>
+bool decode(std::map<K, V> &map, SpanSource &src) {
+    uint32_t size;
+    if (!decode(size, src)) {
+        return false;
+    }
+    map.clear();
+    while (size--) {
+        K key;
+        V value;
+        if (!decode(key, src) || !decode(value, src)) {
+            return false;
+        }
+        map.insert({key, std::move(value)});
+    }
+    return true;
+}
+
+inline bool decode(std::string &arg, SpanSource &src) {
+    uint8_t size;
+    if (!decode(size, src)) {
+        return false;
+    }
+    if (size > src.remaining()) {
+        return src.starve(size);
+    }
+    arg.resize(size);
+    return src.take(arg.data(), size);
+}
+
+/* Decodes arg from the front of bytes in one pass. Returns the number of
+   bytes consumed, or nullopt when bytes hold only a part of the message;
+   needed is then the length bytes must reach before another try can get
+   further, so a message arriving in many chunks is not decoded from its
+   start after every one of them. */
+template <class T>
+std::optional<size_t> try_decode(T &arg, std::span<const std::byte> bytes, size_t &needed) {
+    SpanSource src = {bytes};
+    if (!decode(arg, src)) {
+        needed = src.needed;
+        return std::nullopt;
+    }
+    return src.offset;
+}
+
+template <class T>
+std::optional<size_t> try_decode(T &arg, std::span<const std::byte> bytes) {
+    size_t needed;
+    return try_decode(arg, bytes, needed);
+}
+
+/* -------------------------------------------------------------------------
+   Read-only views decoded in place over received bytes
+   ------------------------------------------------------------------------- */
+/* Declarations */
+template <FixedWire T>
+class WireSpan;
+template <class T>
+class ListView;
+
+struct BombExplodedView;
+struct TurnView;
+
+/* Definitions */
+/* List<T> of fixed-size elements left in their big-endian wire form,
+   each element is decoded on access */
+template <FixedWire T>
+class WireSpan {
+    static constexpr size_t STRIDE = fixed_wire_size_v<T>;
+
+public:
+    class iterator {
+    public:
+        iterator(const std::byte *pos) : pos(pos) {}
+        T operator*() const {
+            T elem;
+            decode_fixed(elem, pos);
+            return elem;
+        }
+        iterator &operator++() {
+            pos += STRIDE;
+            return *this;
+        }
+        bool operator==(const iterator &) const = default;
+
+    private:
+        const std::byte *pos;
+    };
+
+    size_t size() const {
+        return bytes.size() / STRIDE;
+    }
+
+    T operator[](size_t index) const {
+        return *iterator(bytes.data() + index * STRIDE);
+    }
+
+    iterator begin() const {
+        return iterator(bytes.data());
+    }
+
+    iterator end() const {
+        return iterator(bytes.data() + bytes.size());
+    }
+
+    friend bool decode(WireSpan &arg, SpanSource &src) {
+        uint32_t size;
+        if (!decode(size, src)) {
+            return false;
+        }
+        if (size > src.remaining() / STRIDE) {
+            return src.starve((size_t) size * STRIDE);
+        }
+        arg.bytes = src.bytes.subspan(src.offset, size * STRIDE);
+        src.offset += arg.bytes.size();
+        return true;
+    }
+
+private:
+    std::span<const std::byte> bytes;
+};
+
+/* List<T> of variable-size elements, validated once when decoded and then
+   decoded element by element while iterating */
+template <class T>
+class ListView {
+public:
+    class iterator {
+    public:
+        iterator(std::span<const std::byte> bytes, uint32_t left) 
+            : src{bytes}, left(left) {
+            if (left > 0) {
+                decode(current, src);
+            }
+        }
+        const T &operator*() const {
+            return current;
+        }
+        iterator &operator++() {
+            if (--left > 0) {
+                decode(current, src);
+            }
+            return *this;
+        }
+        bool operator==(const iterator &other) const {
+            return left == other.left;
+        }
+
+    private:
+        SpanSource src;
+        uint32_t left;
+        T current;
+    };
+
+    uint32_t size() const {
+        return count;
+    }
+
+    iterator begin() const {
+        return iterator(bytes, count);
+    }
+
+    iterator end() const {
+        return iterator({}, 0);
+    }
+
+    friend bool decode(ListView &arg, SpanSource &src) {
+        uint32_t size;
+        if (!decode(size, src)) {
+            return false;
+        }
+        size_t elements_start = src.offset;
+        for (uint32_t i = 0; i < size; i++) {
+            T elem;
+            if (!decode(elem, src)) {
+                return false;
+            }
+        }
+        arg.bytes = src.bytes.subspan(elements_start, src.offset - elements_start);
+        arg.count = size;
+        return true;
+    }
+
+private:
+    std::span<const std::byte> bytes;
+    uint32_t count = 0;
+};
+
+struct BombExplodedView {
+    BombId id;
+    WireSpan<PlayerId> robots_destroyed;
+    WireSpan<Position> blocks_destroyed;
+};
+
+using EventView = std::variant<BombPlaced, BombExplodedView, PlayerMoved, BlockPlaced>;
+
+struct TurnView {
+    uint16_t turn;
+    ListView<EventView> events;
+};
+
+/* ServerMessageClient with the Turn left in the received bytes */
+using ServerMessageView = std::variant<Hello, AcceptedPlayer, GameStarted, TurnView, GameEnded>;
+
+/* -------------------------------------------------------------------------
+   Buffered reader serving try_decode and deserialize from a stream socket
+   ------------------------------------------------------------------------- */
+/* Pulls data from the stream in large chunks with async_read_some and hands
+   it out to try_decode or deserialize from memory, so a message costs one
+   read per chunk instead of one read per field. The storage is reused
+   between messages; unread bytes are moved to the front instead of wrapping
+   around, which keeps the buffered data contiguous. The buffer only grows
+   when a single fill finds it full of unread data. */
+template <class Stream>
+class BufferedReader {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    explicit BufferedReader(Stream &stream, size_t capacity = DEFAULT_CAPACITY)
+        : stream(stream), buffer(capacity) {}
+
+    /* read callback for deserialize, suspends only when the buffer runs dry */
+    awaitable<void> operator()(void *arg, size_t size) {
+        char *dest = (char *) arg;
+        while (size > 0) {
+            if (head == tail) {
+                co_await fill();
+            }
+            size_t chunk = std::min(size, tail - head);
+            memcpy(dest, buffer.data() + head, chunk);
+            head += chunk;
+            dest += chunk;
+            size -= chunk;
+        }
+        co_return;
+    }
+
+    /* appends at least one byte from the stream to the buffered data */
+    awaitable<void> fill() {
+        if (head == tail) {
+            head = tail = 0;
+        }
+        if (tail == buffer.size()) {
+            if (head > 0) {
+                memmove(buffer.data(), buffer.data() + head, tail - head);
+                tail -= head;
+                head = 0;
+            }
+            else {
+                buffer.resize(2 * buffer.size());
+            }
+        }
+        tail += co_await stream.async_read_some(
+            boost::asio::buffer(buffer.data() + tail, buffer.size() - tail),
+            use_awaitable
+        );
+        co_return;
+    }
+
+    /* reads until at least size bytes are buffered; the storage grows only
+       as the data arrives, not on the word of a length field */
+    awaitable<void> fill(size_t size) {
+        while (tail - head < size) {
+            co_await fill();
+        }
+        co_return;
+    }
+
+    std::span<const std::byte> data() const {
+        return {buffer.data() + head, tail - head};
+    }
+
+    size_t size() const {
+        return tail - head;
+    }
+
+    void consume(size_t size) {
+        head += std::min(size, tail - head);
+    }
+
+private:
+    Stream &stream;
+    std::vector<std::byte> buffer;
+    size_t head = 0;
+    size_t tail = 0;
+};